@@ -3,9 +3,122 @@
 
 #include <sstream>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
 #include <array>
 #include <istream>
 #include <memory>
+#include <string>
+#include <streambuf>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+// C++17 library support (std::optional, std::variant)
+#ifndef FORMAT_UTIL_CPP17
+    #if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+        #define FORMAT_UTIL_CPP17 1
+    #else
+        #define FORMAT_UTIL_CPP17 0
+    #endif
+#endif
+
+#if FORMAT_UTIL_CPP17
+    #include <optional>
+    #include <variant>
+#endif
+
+// Conversion of numbers via std::to_chars (C++17 library with floating-point support).
+// Otherwise integers are converted by the built-in code and floating-point numbers via snprintf.
+// The output is the same as the output via the stream in both cases.
+#ifndef FORMAT_UTIL_TO_CHARS
+    #if FORMAT_UTIL_CPP17 && defined(__has_include)
+        #if __has_include(<charconv>)
+            #include <charconv>
+        #endif
+    #endif
+    #if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        #define FORMAT_UTIL_TO_CHARS 1
+    #else
+        #define FORMAT_UTIL_TO_CHARS 0
+    #endif
+#elif FORMAT_UTIL_TO_CHARS
+    #include <charconv>
+#endif
+
+// Differential check of the numbers converted without the stream (for test and debug builds).
+// With FORMAT_UTIL_VERIFY defined as 1 each such number is also output via the stream with the same settings;
+// on mismatch the stream output is used and the case is recorded (see Formatter::Mismatches).
+// With FORMAT_UTIL_VERIFY_CORPUS defined as a file name the cases are also appended to the file,
+// so the corpus of mismatches is kept between runs.
+#ifndef FORMAT_UTIL_VERIFY
+    #define FORMAT_UTIL_VERIFY 0
+#endif
+
+#if FORMAT_UTIL_VERIFY
+    #include <mutex>
+    #include <fstream>
+    #include <limits>
+#endif
+
+// SSE2 is used for the fast check of ASCII text (see Formatter::Utf8Mode)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FORMAT_UTIL_SSE2 1
+    #include <emmintrin.h>
+#else
+    #define FORMAT_UTIL_SSE2 0
+#endif
+
+// Output of network addresses (in_addr, in6_addr, sockaddr_storage etc.) requires system headers,
+// it is enabled by defining FORMAT_UTIL_NETWORK before including the header
+#ifdef FORMAT_UTIL_NETWORK
+    #ifdef _WIN32
+        #include <winsock2.h>
+        #include <ws2tcpip.h>
+    #else
+        #include <sys/socket.h>
+        #include <netinet/in.h>
+    #endif
+#endif
+
+// Names of enumeration values for the output by Formatter.
+// The template is specialized via FORMAT_UTIL_ENUM-macro (see below)
+template<typename E>
+struct FormatterEnum
+{ };
+
+template<typename T>
+class BasicFormatTemplate;
+
+template<typename T>
+class BasicStyledTemplate;
+
+// Conversions of arguments before the output, the default policy outputs them as they are.
+// Policies are used by PolicyFormatter (see below)
+struct DefaultFormatPolicy
+{
+    template<typename T>
+    static const T& Convert(const T &t)
+    {
+        return t;
+    }
+};
 
 ///\brief String formatter.
 ///\details Class for filling strings with formatted arguments
@@ -24,20 +137,115 @@
 ///
 class Formatter
 {
+    protected:
+        // Maps any set of valid types to 'void' (used for SFINAE in partial specializations)
+        template<typename... Types>
+        struct Void
+        {
+            typedef void type;
+        };
+
+        // Compile-time sequence of indices (std::index_sequence is not available in C++11)
+        template<size_t... I>
+        struct Indices
+        { };
+
+        template<size_t N, size_t... I>
+        struct MakeIndices : MakeIndices<N - 1, N - 1, I...>
+        { };
+
+        template<size_t... I>
+        struct MakeIndices<0, I...>
+        {
+            typedef Indices<I...> type;
+        };
+
+        // Checks whether the type is a character type
+        template<typename C>
+        struct IsChar : std::integral_constant<bool,
+                std::is_same<C, char>::value || std::is_same<C, wchar_t>::value ||
+                std::is_same<C, char16_t>::value || std::is_same<C, char32_t>::value>
+        { };
+
+        // Detects contiguous ranges of characters: types with 'data()' and 'size()' members,
+        // where 'data()' returns a pointer to a character type.
+        // CharType is defined for such ranges only.
+        template<typename Range, typename Enable = void>
+        struct CharRange
+        { };
+
+        template<typename Range>
+        struct CharRange<Range, typename std::enable_if<
+                IsChar<typename std::remove_cv<typename std::remove_pointer<
+                    decltype(std::declval<const Range&>().data())>::type>::type>::value &&
+                std::is_integral<decltype(std::declval<const Range&>().size())>::value>::type>
+        {
+            typedef typename std::remove_cv<typename std::remove_pointer<
+                    decltype(std::declval<const Range&>().data())>::type>::type CharType;
+        };
+
+        // Detects string-like types (std::basic_string, std::basic_string_view etc.):
+        // character ranges which have their own character traits
+        template<typename V, typename Enable = void>
+        struct StringLike : std::false_type
+        { };
+
+        template<typename V>
+        struct StringLike<V, typename Void<typename V::traits_type,
+                typename CharRange<V>::CharType>::type> : std::true_type
+        { };
+
+        // Detects enumerations which have names registered via FORMAT_UTIL_ENUM-macro
+        template<typename E, typename Enable = void>
+        struct RegisteredEnum : std::false_type
+        { };
+
+        template<typename E>
+        struct RegisteredEnum<E, typename Void<decltype(FormatterEnum<E>::Table())>::type> : std::true_type
+        { };
+
+        // Numbers which are converted directly when the flags and the locale allow it:
+        // integers except bool and characters, float and double
+        template<typename V>
+        struct Number : std::integral_constant<bool,
+                (std::is_integral<V>::value && !std::is_same<V, bool>::value && !IsChar<V>::value && sizeof(V) > 1) ||
+                std::is_same<V, float>::value || std::is_same<V, double>::value>
+        { };
+
+        // Detects pointee types, values of which can be output via a pointer (all except void).
+        // The completeness of the type is not detected: the result would depend on the point of instantiation.
+        template<typename V>
+        struct Dereferenceable : std::integral_constant<bool,
+                !std::is_void<V>::value && !std::is_function<V>::value>
+        { };
+
+        // Types which have their own output, but also match the generic output
+        // of types with operator<< or of iterable types
+        template<typename V>
+        struct NativeOutput : std::integral_constant<bool,
+                StringLike<V>::value || RegisteredEnum<V>::value || Number<V>::value>
+        { };
+
     public:
         Formatter()
            : m_ptr_locale(new std::locale()),
              m_flags(std::ios_base::skipws | std::ios_base::dec),
-             m_precision(6)
-        { }
+             m_precision(6),
+             m_utf8(Utf8Mode::Pass)
+        {
+            UpdateNumPunct();
+        }
 
         Formatter(const std::locale& loc,
                   std::ios_base::fmtflags flags = std::ios_base::skipws | std::ios_base::dec,
                   std::streamsize precision = 6)
            : m_ptr_locale(new std::locale(loc)),
              m_flags(flags),
-             m_precision(precision)
-        { }
+             m_precision(precision),
+             m_utf8(Utf8Mode::Pass)
+        {
+            UpdateNumPunct();
+        }
 
         ~Formatter()
         { }
@@ -47,10 +255,9 @@ class Formatter
         ///\param args - list of arguments
         ///\return built string
         template<typename T, typename... Args>
-        std::basic_string<T> Format(const T* seq, Args... args)
+        std::basic_string<T> Format(const T* seq, const Args&... args)
         {
-            std::basic_string<T> str(seq);
-            return Format(str, args...);
+            return FormatRange(seq, std::char_traits<T>::length(seq), args...);
         }
 
         ///\brief Generates string from another string filled with parameters.
@@ -58,41 +265,331 @@ class Formatter
         ///\param args - list of arguments
         ///\return built string
         template<typename T, typename... Args>
-        std::basic_string<T> Format(const std::basic_string<T> &str, Args... args)
-        {
-            std::basic_stringstream<T> stream;
-            AssignStreamSettings(stream);
-            // Collect parameters (arguments string-values)
-            const size_t args_sz = sizeof...(args);
-            std::array<std::basic_string<T>, args_sz> parameter_values;
-            GetOutputParameters(stream, parameter_values.begin(), args...);
-            // Parse, insert parameters, and build final string
-            size_t pos = 0;
-            size_t last_pos = 0;
-            size_t arg_counter = 0;
-            size_t mask_len = std::strlen(SUBSTITUTE_MASK);
-            while((pos = str.find(SUBSTITUTE_MASK, last_pos))!=str.npos)
+        std::basic_string<T> Format(const std::basic_string<T> &str, const Args&... args)
+        {
+            return FormatRange(str.data(), str.size(), args...);
+        }
+
+        ///\brief Generates string from a contiguous range of characters filled with parameters.
+        /// The range is parsed in place, without copying it into a string first.
+        /// Any type with 'data()' and 'size()' members over a character type is accepted:
+        /// std::basic_string_view, std::vector<char>, std::array<char, N>, user-defined slices etc.
+        ///\param range - initial characters range
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        std::basic_string<T> Format(const Range &range, const Args&... args)
+        {
+            return FormatRange(range.data(), range.size(), args...);
+        }
+
+        ///\brief Generates string from a characters sequence of the given length filled with parameters.
+        /// The sequence does not have to be null-terminated (for example, a slice of a larger buffer).
+        /// If there are no arguments, the sequence is returned as is.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> FormatRange(const T* seq, size_t size, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatRangeTo(result, seq, size, args...);
+            return result;
+        }
+
+        ///\brief Appends char sequence filled with parameters to the output target.
+        /// The target is a string, a vector of characters or any sink (see 'Output sinks' below).
+        /// Allows to build output in an existing buffer (reusing its memory) without temporary strings.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const T* seq, const Args&... args)
+        {
+            FormatRangeTo(target, seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Appends contiguous range of characters (string, string_view etc.) filled with parameters
+        /// to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param range - initial characters range
+        ///\param args - list of arguments
+        template<typename Target, typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        void FormatTo(Target &target, const Range &range, const Args&... args)
+        {
+            FormatRangeTo(target, range.data(), range.size(), args...);
+        }
+
+        ///\brief Appends characters sequence of the given length filled with parameters to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatRangeTo(Target &target, const T* seq, size_t size, const Args&... args)
+        {
+            FormatRangeWith<DefaultFormatPolicy>(target, seq, size, args...);
+        }
+
+        ///\brief Compiles char sequence into a template for repeated output.
+        /// The sequence is parsed once: the output of the template only copies literal parts
+        /// and arguments, without searching for format specifiers.
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\return compiled template
+        template<typename T>
+        BasicFormatTemplate<T> Compile(const T* seq)
+        {
+            return CompileRange(seq, std::char_traits<T>::length(seq));
+        }
+
+        ///\brief Compiles contiguous range of characters (string, string_view etc.) into a template.
+        ///\param range - characters range
+        ///\return compiled template
+        template<typename Range,
+                typename T = typename CharRange<Range>::CharType>
+        BasicFormatTemplate<T> Compile(const Range &range)
+        {
+            return CompileRange(range.data(), range.size());
+        }
+
+        ///\brief Compiles characters sequence of the given length into a template.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\return compiled template
+        template<typename T>
+        BasicFormatTemplate<T> CompileRange(const T* seq, size_t size)
+        {
+            BasicFormatTemplate<T> result;
+            result.m_source.assign(seq, size);
+            result.m_ends.clear();
+            StringSink<T> sink(result.m_text);
+            const T *first = seq;
+            while(CopyLiteral(sink, first, seq + size))
+                result.m_ends.push_back(result.m_text.size());
+            result.m_ends.push_back(result.m_text.size());
+            return result;
+        }
+
+        ///\brief Compiles char sequence with style markup into coloured and plain templates.
+        /// Markup: '{bold}', '{red}', '{bold,bg_blue}' start a style, '{/}' ends the last started style,
+        /// '%<red>?' is a format specifier with its own style, '{{' is output as '{'.
+        /// Styles: bold, dim, italic, underline, blink, reverse, strike, colours black, red, green, yellow,
+        /// blue, magenta, cyan, white, gray, bright_red ... bright_white and backgrounds bg_black ... bg_white.
+        /// The markup is translated into ANSI escape sequences in the coloured template and removed
+        /// from the plain one, so the output does not check styles at all; a template is selected
+        /// once (for example, by 'BasicStyledTemplate::IsTerminal'). Unknown markup is output as is.
+        /// Both templates take the same arguments: markup keeps apart the characters around it, so
+        /// '100%{bold}%?{/}' outputs '100%' and the argument, '%{bold}?' outputs '%?' in both templates.
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\return compiled templates
+        template<typename T>
+        BasicStyledTemplate<T> CompileStyled(const T* seq)
+        {
+            return CompileStyledRange(seq, std::char_traits<T>::length(seq));
+        }
+
+        ///\brief Compiles contiguous range of characters with style markup into coloured and plain templates.
+        ///\param range - characters range
+        ///\return compiled templates
+        template<typename Range,
+                typename T = typename CharRange<Range>::CharType>
+        BasicStyledTemplate<T> CompileStyled(const Range &range)
+        {
+            return CompileStyledRange(range.data(), range.size());
+        }
+
+        ///\brief Compiles characters sequence of the given length with style markup into coloured and plain templates.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\return compiled templates
+        template<typename T>
+        BasicStyledTemplate<T> CompileStyledRange(const T* seq, size_t size)
+        {
+            std::basic_string<T> colored;
+            std::vector<bool> escapes;
+            TranslateStyles(seq, size, colored, escapes);
+            BasicStyledTemplate<T> result;
+            result.m_colored = CompileRange(colored.data(), colored.size());
+            // The plain template is parsed from the coloured sequence too, skipping the escapes:
+            // removed markup must not join '%' and '?' into a specifier or a screened '%%?'
+            BasicFormatTemplate<T> &plain = result.m_plain;
+            UnstyledSink<T> source(plain.m_source, colored.data(), escapes);
+            source.Append(colored.data(), colored.size());
+            plain.m_text.clear();
+            plain.m_ends.clear();
+            UnstyledSink<T> sink(plain.m_text, colored.data(), escapes);
+            const T *first = colored.data();
+            const T *last = first + colored.size();
+            while(CopyLiteral(sink, first, last))
+                plain.m_ends.push_back(plain.m_text.size());
+            plain.m_ends.push_back(plain.m_text.size());
+            return result;
+        }
+
+        ///\brief Generates string from compiled template filled with parameters.
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> Format(const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatTo(result, tmpl, args...);
+            return result;
+        }
+
+        ///\brief Appends compiled template filled with parameters to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            FormatTemplateWith<DefaultFormatPolicy>(target, tmpl, args...);
+        }
+
+        ///\brief Appends compiled template filled with text fields to the output target.
+        /// Fields are copied as is (for example, columns of a parsed file given at run time).
+        /// Missing fields are output as '?', odd fields are ignored; without fields the sequence is output as is.
+        ///\param target - string, vector or sink to append the output to
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param fields - array of fields
+        ///\param count - number of fields
+        template<typename Target, typename T>
+        void FormatFieldsTo(Target &target, const BasicFormatTemplate<T> &tmpl,
+                            const typename BasicFormatTemplate<T>::Field *fields, size_t count)
+        {
+            typedef SinkOf<Target> Adapter;
+            typename Adapter::Type sink(Adapter::Get(target));
+            if(count==0)
             {
-                if(pos > 0 && str.at(pos - 1)=='%') // Ignore screened '%%?'-value
-                {
-                    stream << str.substr(last_pos, pos - last_pos - 1) << SUBSTITUTE_MASK;
-                    last_pos = (pos += mask_len);
-                    continue;
-                }
-                stream << str.substr(last_pos, pos - last_pos);
-                stream << (arg_counter < args_sz ? parameter_values[arg_counter++] : "?");
-                last_pos = (pos += mask_len);
+                if(!tmpl.m_source.empty())
+                    sink.Append(tmpl.m_source.data(), tmpl.m_source.size());
+                return;
+            }
+            const T missing = static_cast<T>('?');
+            const size_t parts = tmpl.m_ends.size();
+            size_t begin = 0;
+            for(size_t i = 0; i < parts; ++i)
+            {
+                const size_t end = tmpl.m_ends[i];
+                if(end > begin)
+                    sink.Append(tmpl.m_text.data() + begin, end - begin);
+                begin = end;
+                if(i + 1==parts)
+                    break;
+                if(i >= count)
+                    sink.Append(&missing, 1);
+                else if(fields[i].size > 0)
+                    AppendField(sink, fields[i].data, fields[i].size, std::is_same<T, char>());
+            }
+        }
+
+        ///\brief Computes hash of the char sequence filled with parameters without building the string.
+        /// The output is hashed while it is produced. The result is the same as the result of 'Hash'
+        /// for the built string, so the method can be used for cache lookups without allocations.
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        ///\return 64-bit hash (XXH64 of the output bytes)
+        template<typename T, typename... Args>
+        uint64_t FormatHash(const T* seq, const Args&... args)
+        {
+            return FormatRangeHash(seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Computes hash of the contiguous range of characters filled with parameters without building the string.
+        ///\param range - initial characters range (string, string_view etc.)
+        ///\param args - list of arguments
+        ///\return 64-bit hash (XXH64 of the output bytes)
+        template<typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        uint64_t FormatHash(const Range &range, const Args&... args)
+        {
+            return FormatRangeHash(range.data(), range.size(), args...);
+        }
+
+        ///\brief Computes hash of the characters sequence of the given length filled with parameters.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return 64-bit hash (XXH64 of the output bytes)
+        template<typename T, typename... Args>
+        uint64_t FormatRangeHash(const T* seq, size_t size, const Args&... args)
+        {
+            HashSink<T> sink;
+            {
+                Writer<T, HashSink<T>> out(*this, sink);
+                Render(out, seq, seq + size, args...);
             }
-            stream << str.substr(last_pos, str.size() - last_pos);
-            return stream.str();
+            return sink.Digest();
         }
 
-        ///\brief No parameters string processing: returns the initial string
-        ///\param str -- initial string
+        ///\brief Computes hash of characters in the same way as 'FormatHash' does for the output.
+        ///\param data - pointer to the first character
+        ///\param size - number of characters
+        ///\return 64-bit hash (XXH64 of the characters bytes)
         template<typename T>
-        std::string Format(const std::basic_string<T> &str)
+        static uint64_t Hash(const T *data, size_t size)
         {
-            return str;
+            Xxh64 hash;
+            hash.Update(data, size * sizeof(T));
+            return hash.Digest();
+        }
+
+        ///\brief Computes hash of the string (string, string_view etc.) in the same way as 'FormatHash' does for the output.
+        ///\param str - characters range
+        ///\return 64-bit hash (XXH64 of the characters bytes)
+        template<typename Range,
+                typename T = typename CharRange<Range>::CharType>
+        static uint64_t Hash(const Range &str)
+        {
+            return Hash(str.data(), static_cast<size_t>(str.size()));
+        }
+
+        ///\brief Checks whether the string is equal to the char sequence filled with parameters.
+        /// The output is compared with the string while it is produced, without building the output string.
+        ///\param str - string to compare with (string, string_view etc.)
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        ///\return true if the output is equal to the string
+        template<typename Str, typename T, typename... Args,
+                typename = typename std::enable_if<std::is_same<typename CharRange<Str>::CharType, T>::value>::type>
+        bool FormatEquals(const Str &str, const T* seq, const Args&... args)
+        {
+            return FormatRangeEquals(str, seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Checks whether the string is equal to the contiguous range of characters filled with parameters.
+        ///\param str - string to compare with (string, string_view etc.)
+        ///\param range - initial characters range
+        ///\param args - list of arguments
+        ///\return true if the output is equal to the string
+        template<typename Str, typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType,
+                typename = typename std::enable_if<std::is_same<typename CharRange<Str>::CharType, T>::value>::type>
+        bool FormatEquals(const Str &str, const Range &range, const Args&... args)
+        {
+            return FormatRangeEquals(str, range.data(), range.size(), args...);
+        }
+
+        ///\brief Checks whether the string is equal to the characters sequence of the given length filled with parameters.
+        ///\param str - string to compare with (string, string_view etc.)
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return true if the output is equal to the string
+        template<typename Str, typename T, typename... Args>
+        bool FormatRangeEquals(const Str &str, const T* seq, size_t size, const Args&... args)
+        {
+            CompareSink<T> sink(str.data(), static_cast<size_t>(str.size()));
+            {
+                Writer<T, CompareSink<T>> out(*this, sink);
+                Render(out, seq, seq + size, args...);
+            }
+            return sink.Equal();
         }
 
         /// Returns current formatting settings
@@ -155,6 +652,7 @@ class Formatter
         {
             const std::locale old_locale = *m_ptr_locale;
             *m_ptr_locale = loc;
+            UpdateNumPunct();
             return old_locale;
         }
 
@@ -185,160 +683,3606 @@ class Formatter
             return old_prec;
         }
 
-        // Proxy class for the output via 'operator<<'
-        // The class is used in 'Output'-method (see below)
-        template<typename T>
-        struct FWrapper
+        // Policy for UTF-8 text of string arguments (strings, string views, C-strings and text fields of char type)
+        enum class Utf8Mode
         {
-            T t;
+            Pass,   // strings are copied as is
+            Replace // strings are validated while they are copied, invalid sequences are replaced by U+FFFD
         };
 
-        /// The helper-method for suppressing ambiguous overloading for output.
-        /// Returns a proxy-object which wraps a real object.
-        /// The proxy-object has its own operator<< which calls operator<< for the wrapped object directly, without SFINAE.
-        /// For example,
-        ///     SomeObject some_object;
-        ///     Formatter formatter;
-        ///     std::string result = formatter.format("String object value: %?", formatter.Output(some_object));
-        /// In this case the 'some_object' value will be output to the string directly via operator<<.
-        /// It is a simple way to avoid an ambiguous overloading, if occurs
-        ///\param t - object for direct invoking operator<<
-        ///\return The proxy object which can be output
-        template<typename T>
-        FWrapper<T> Output(T t)
+        ///\brief Gets the policy for UTF-8 text of string arguments.
+        ///\return Current policy
+        Utf8Mode Utf8() const
         {
-            FWrapper<T> w;
-            w.t = t;
-            return w;
+            return m_utf8;
         }
 
-    private:
-        // The format specifier
-        const char *SUBSTITUTE_MASK = "%?";
-
-        // Current locale for formatting
-        std::unique_ptr<std::locale> m_ptr_locale;
-        // Current set of flags for formatting
-        std::ios_base::fmtflags m_flags;
-        // Current precision for formatting of numeric values
-        std::streamsize m_precision;
-
-        // Assigns locale, precision and flags for the given stream
-        template <typename Stream>
-        void AssignStreamSettings(Stream &stream)
+        ///\brief Sets the policy for UTF-8 text of string arguments.
+        /// With 'Replace' each maximal invalid subsequence is replaced by U+FFFD
+        /// (the same as by the WHATWG decoder), so the output is always valid UTF-8 if the format sequence is.
+        /// ASCII text is checked 16 bytes at a time.
+        ///\param mode - new policy
+        ///\return Previous policy
+        Utf8Mode Utf8(Utf8Mode mode)
         {
-            stream.precision(m_precision);
-            stream.imbue(*m_ptr_locale);
-            stream.flags(m_flags);
+            const Utf8Mode old_mode = m_utf8;
+            m_utf8 = mode;
+            return old_mode;
         }
 
-        // Puts output value into an array at the iterator position
-        // stream - stream to get a string value
-        // it - current iterator of a dynamic array
-        // t - current argument
-        // args - other arguments
-        template <typename Stream, typename T, typename It, typename... Args>
-        void GetOutputParameters(Stream &stream, It it, T t, Args... args)
+#if FORMAT_UTIL_VERIFY
+        /// Returns descriptions of the numbers whose direct conversion did not match the stream output
+        /// (see FORMAT_UTIL_VERIFY), the stream output was used for them
+        static std::vector<std::string> Mismatches()
         {
-            OutputValue(stream, t);
-            *it = stream.str();
-            stream.str("");
-            GetOutputParameters(stream, ++it, args...);
+            MismatchLog &log = Log();
+            std::lock_guard<std::mutex> lock(log.mutex);
+            return log.cases;
         }
+#endif
 
-        // Puts the last output value into an array at the iterator position
-        // stream - stream to get a string value
-        // it - current iterator of a dynamic array
-        // t - last argument
-        template <typename Stream, typename T, typename It>
-        void GetOutputParameters(Stream &stream, It it, T t)
-        {
-            OutputValue(stream, t);
-            *it = stream.str();
-            stream.str("");
-        }
+        // Output sinks.
+        // A sink receives the output characters. Any class with the method
+        //     void Append(const T *data, size_t size)
+        // is a sink, so the output may be directed anywhere without changing the formatter.
+        // Optional methods:
+        //     void Reserve(size_t size) - is called with the expected size before the output;
+        //     void Flush() - is called when a value output via operator<< flushes the stream.
 
-        // Outputs type which has an 'operator<<', to a string stream
-        // stream - stream to get a string value
-        // t - type value
-        template<typename Stream, typename T,
-                typename Output = decltype(std::cout << std::declval<T>())>
-        void OutputValue(Stream &stream, const T &t)
+        // Sink which appends characters to a string
+        template<typename T>
+        class StringSink
         {
-            stream << t;
-        }
+            public:
+                explicit StringSink(std::basic_string<T> &str)
+                    : m_str(str)
+                { }
 
-        // Outputs type which can be iterated, to a string stream
-        // stream - stream to get a string value
-        // t - type value
-        template<typename Stream, typename T,
-                typename It = typename T::const_iterator,
-                typename Type = typename T::value_type,
-                typename Begin = decltype(std::declval<T>().begin()),
-                typename End = decltype(std::declval<T>().end())>
-        void OutputValue(Stream &stream, const T &t)
-        {
-            stream << "[";
-            if(t.empty())
-            {
-                stream << "]";
-                return;
-            }
-            It last = --t.end();
-            for(It it=t.begin(); it!=t.end(); ++it)
-            {
-                OutputValue(stream, *it);
-                if(it!=last)
-                    stream << ", ";
-            }
-            stream << "]";
-        }
+                void Append(const T *data, size_t size)
+                {
+                    m_str.append(data, size);
+                }
 
-        // Outputs value for basic_string derivatives to a string stream
-        // stream - stream to get a string value
-        // str - string value
-        template<typename Stream, typename T,
-                typename Output = decltype(std::cout << std::declval<std::basic_string<T>>())>
-        void OutputValue(Stream &stream, const std::basic_string<T> &str)
+                void Reserve(size_t size)
+                {
+                    m_str.reserve(m_str.size() + size);
+                }
+
+            private:
+                std::basic_string<T> &m_str;
+        };
+
+        // Sink which appends characters to a vector
+        template<typename T>
+        class VectorSink
         {
-            stream << str;
-        }
+            public:
+                explicit VectorSink(std::vector<T> &vec)
+                    : m_vec(vec)
+                { }
 
-        // Outputs pair-values in braces to a string stream
-        // stream - stream to get a string value
-        // value - pair value
-        template<typename Stream, typename T, typename V>
-        void OutputValue(Stream &stream, const std::pair<T,V> &value)
+                void Append(const T *data, size_t size)
+                {
+                    m_vec.insert(m_vec.end(), data, data + size);
+                }
+
+                void Reserve(size_t size)
+                {
+                    m_vec.reserve(m_vec.size() + size);
+                }
+
+            private:
+                std::vector<T> &m_vec;
+        };
+
+        // Sink which writes characters into a fixed buffer, the output which does not fit is truncated.
+        // The content of the buffer is always null-terminated.
+        template<typename T>
+        class FixedSink
         {
-            stream << '{';
-            OutputValue(stream, value.first);
-            stream << " : ";
-            OutputValue(stream, value.second);
-            stream << '}';
-        }
+            public:
+                FixedSink(T *buffer, size_t capacity)
+                    : m_buffer(buffer),
+                      m_capacity(capacity),
+                      m_size(0),
+                      m_truncated(false)
+                {
+                    if(m_capacity > 0)
+                        m_buffer[0] = T();
+                }
+
+                template<size_t N>
+                explicit FixedSink(T (&buffer)[N])
+                    : FixedSink(buffer, N)
+                { }
 
-        // Outputs bool-values to a string stream: as 'true' or 'false'
-        template<typename Stream>
-        void OutputValue(Stream &stream, bool b)
+                void Append(const T *data, size_t size)
+                {
+                    if(m_capacity==0)
+                    {
+                        m_truncated = m_truncated || size > 0;
+                        return;
+                    }
+                    const size_t room = m_capacity - 1 - m_size;
+                    if(size > room)
+                    {
+                        size = room;
+                        m_truncated = true;
+                    }
+                    std::char_traits<T>::copy(m_buffer + m_size, data, size);
+                    m_size += size;
+                    m_buffer[m_size] = T();
+                }
+
+                // Returns number of written characters (without the null-terminator)
+                size_t Size() const
+                {
+                    return m_size;
+                }
+
+                // Returns true if some output did not fit into the buffer
+                bool Truncated() const
+                {
+                    return m_truncated;
+                }
+
+                // Starts writing from the beginning of the buffer
+                void Clear()
+                {
+                    m_size = 0;
+                    m_truncated = false;
+                    if(m_capacity > 0)
+                        m_buffer[0] = T();
+                }
+
+            private:
+                T *m_buffer;
+                size_t m_capacity;
+                size_t m_size;
+                bool m_truncated;
+        };
+
+        // Sink which only counts the output characters (for example, to compute the size in advance)
+        template<typename T>
+        class CountingSink
         {
-            stream << (b ? "true" : "false");
-        }
+            public:
+                CountingSink()
+                    : m_count(0)
+                { }
 
-        // Outputs unknown type to a string stream as a '?'-character
-        template<typename Stream>
-        void OutputValue(Stream &stream, ...)
+                void Append(const T*, size_t size)
+                {
+                    m_count += size;
+                }
+
+                size_t Count() const
+                {
+                    return m_count;
+                }
+
+            private:
+                size_t m_count;
+        };
+
+        // Sink which writes characters to a file descriptor through a buffer.
+        // The buffer is written when it is full, on 'Flush' and on destruction.
+        // Write errors are not thrown: 'Good' returns false after the first failed write.
+        class FdSink
         {
-            stream << "?";
-        }
-};
+            public:
+                explicit FdSink(int fd, size_t buffer_size = 64 * 1024)
+                    : m_fd(fd),
+                      m_buffer(buffer_size > 0 ? buffer_size : 1),
+                      m_size(0),
+                      m_good(true)
+                { }
 
-// Helper function for output proxy-object (FWrapper) via operator<<.
-// See method 'Output' of Formatter-class
-template<typename T>
-std::ostream& operator<<(std::ostream& os, Formatter::FWrapper<T> fw)
-{
-    os << fw.t;
-    return os;
+                ~FdSink()
+                {
+                    Flush();
+                }
+
+                FdSink(const FdSink&) = delete;
+                FdSink& operator=(const FdSink&) = delete;
+
+                void Append(const char *data, size_t size)
+                {
+                    if(size > m_buffer.size() - m_size)
+                    {
+                        Flush();
+                        if(size >= m_buffer.size()) // Large output is written directly
+                        {
+                            Write(data, size);
+                            return;
+                        }
+                    }
+                    std::memcpy(&m_buffer[m_size], data, size);
+                    m_size += size;
+                }
+
+                // Writes the buffered characters to the file descriptor
+                bool Flush()
+                {
+                    if(m_size > 0)
+                    {
+                        Write(&m_buffer[0], m_size);
+                        m_size = 0;
+                    }
+                    return m_good;
+                }
+
+                bool Good() const
+                {
+                    return m_good;
+                }
+
+            private:
+                int m_fd;
+                std::vector<char> m_buffer;
+                size_t m_size;
+                bool m_good;
+
+                void Write(const char *data, size_t size)
+                {
+                    while(size > 0 && m_good)
+                    {
+#ifdef _WIN32
+                        const int written = _write(m_fd, data, static_cast<unsigned>(size > 0x40000000 ? 0x40000000 : size));
+#else
+                        const ssize_t written = write(m_fd, data, size);
+#endif
+                        if(written < 0)
+                        {
+                            if(errno==EINTR)
+                                continue;
+                            m_good = false;
+                            return;
+                        }
+                        data += written;
+                        size -= static_cast<size_t>(written);
+                    }
+                }
+        };
+
+        // Table of enumeration value names, built once for each enumeration
+        // registered via FORMAT_UTIL_ENUM-macro (see below).
+        // Names are not copied: they point into the stringized list of the macro arguments.
+        // Densely packed values are looked up by indexing, sparse ones by binary search.
+        // Values are kept in the underlying type of the enumeration (U), so the whole range
+        // of unsigned long long enumerations is ordered correctly.
+        template<typename U>
+        class EnumTable
+        {
+            public:
+                template<typename E>
+                EnumTable(const E *values, size_t count, const char *names)
+                    : m_min(0)
+                {
+                    std::vector<Entry> entries;
+                    entries.reserve(count);
+                    for(size_t i = 0; i < count; ++i)
+                    {
+                        // Skip separators and qualification ('Color::Red' -> 'Red')
+                        while(*names==',' || *names==' ' || *names=='\t' || *names=='\n')
+                            ++names;
+                        const char *name_end = names;
+                        const char *name_begin = names;
+                        while(*name_end && *name_end!=',')
+                        {
+                            if(*name_end==':')
+                                name_begin = name_end + 1;
+                            ++name_end;
+                        }
+                        size_t name_size = static_cast<size_t>(name_end - name_begin);
+                        while(name_size > 0 && (name_begin[name_size - 1]==' ' || name_begin[name_size - 1]=='\t'))
+                            --name_size;
+                        Entry entry = {static_cast<U>(values[i]), name_begin, name_size};
+                        entries.push_back(entry);
+                        names = name_end;
+                    }
+                    std::stable_sort(entries.begin(), entries.end(),
+                            [](const Entry &a, const Entry &b) { return a.value < b.value; });
+                    if(entries.empty())
+                        return;
+                    m_min = entries.front().value;
+                    const unsigned long long span = Offset(entries.back().value);
+                    if(span < 4 * entries.size() + 64)
+                    {
+                        Entry empty = {0, nullptr, 0};
+                        m_dense.assign(static_cast<size_t>(span) + 1, empty);
+                        for(size_t i = entries.size(); i-- > 0; ) // Aliases: the first registered name wins
+                            m_dense[static_cast<size_t>(Offset(entries[i].value))] = entries[i];
+                    }
+                    else
+                    {
+                        m_sparse.swap(entries);
+                    }
+                }
+
+                // Finds the name of the value
+                // Returns false if the value is not registered
+                bool Find(U value, const char* &name, size_t &size) const
+                {
+                    const Entry *entry = nullptr;
+                    if(!m_dense.empty())
+                    {
+                        // Values below the minimum wrap around beyond the table
+                        const unsigned long long index = Offset(value);
+                        if(index < m_dense.size())
+                            entry = &m_dense[static_cast<size_t>(index)];
+                    }
+                    else
+                    {
+                        typename std::vector<Entry>::const_iterator it = std::lower_bound(m_sparse.begin(), m_sparse.end(), value,
+                                [](const Entry &e, U v) { return e.value < v; });
+                        if(it!=m_sparse.end() && it->value==value)
+                            entry = &*it;
+                    }
+                    if(!entry || !entry->name)
+                        return false;
+                    name = entry->name;
+                    size = entry->size;
+                    return true;
+                }
+
+            private:
+                typedef typename std::make_unsigned<U>::type Unsigned;
+
+                // Distance of the value from the minimum in unsigned arithmetic (no overflow)
+                unsigned long long Offset(U value) const
+                {
+                    return static_cast<Unsigned>(static_cast<Unsigned>(value) - static_cast<Unsigned>(m_min));
+                }
+
+                struct Entry
+                {
+                    U value;
+                    const char *name;
+                    size_t size;
+                };
+
+                U m_min;
+                std::vector<Entry> m_dense;
+                std::vector<Entry> m_sparse;
+        };
+
+        // Fixed-point decimal value: integer number of minor units and number of fraction digits
+        // The class is used in 'Decimal'-method (see below)
+        struct FDecimal
+        {
+            int64_t value;
+            unsigned scale;
+        };
+
+        /// Returns fixed-point decimal argument for the output of integer amounts of minor units,
+        /// for example, cents: Decimal(1234567, 2) is output as '12345.67'.
+        /// The value is converted by integer arithmetic only, so there are no rounding errors.
+        /// The output is the same as the output of the exact value with 'std::fixed' and precision 'scale'
+        /// using the formatter locale: decimal point, digit grouping and thousands separator
+        /// (i.e. '12,345.67' for a locale with grouping). Flags 'showpos' and 'showpoint' are respected.
+        ///\param value - number of minor units
+        ///\param scale - number of fraction digits (any, digits beyond the value are leading zeros)
+        ///\return The decimal value which can be output
+        static FDecimal Decimal(int64_t value, unsigned scale)
+        {
+            FDecimal d = {value, scale};
+            return d;
+        }
+
+        // Binary identifiers output in their standard text forms
+        // The class is used in 'IPv4', 'IPv6', 'Mac' and 'Uuid' methods (see below)
+        struct FBytes
+        {
+            enum Kind { IPV4, IPV6, MAC, UUID };
+            Kind kind;
+            const unsigned char *bytes;
+        };
+
+        /// Returns IPv4 address argument: 4 bytes in network order, output as 'a.b.c.d'
+        ///\param bytes - pointer to the address bytes
+        static FBytes IPv4(const void *bytes)
+        {
+            FBytes b = {FBytes::IPV4, static_cast<const unsigned char*>(bytes)};
+            return b;
+        }
+
+        /// Returns IPv6 address argument: 16 bytes in network order,
+        /// output in the same form as inet_ntop does (RFC 5952: '2001:db8::1', '::ffff:1.2.3.4')
+        ///\param bytes - pointer to the address bytes
+        static FBytes IPv6(const void *bytes)
+        {
+            FBytes b = {FBytes::IPV6, static_cast<const unsigned char*>(bytes)};
+            return b;
+        }
+
+        /// Returns MAC address argument: 6 bytes, output as 'aa:bb:cc:dd:ee:ff'
+        ///\param bytes - pointer to the address bytes
+        static FBytes Mac(const void *bytes)
+        {
+            FBytes b = {FBytes::MAC, static_cast<const unsigned char*>(bytes)};
+            return b;
+        }
+
+        /// Returns UUID argument: 16 bytes, output as 'xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx'
+        ///\param bytes - pointer to the UUID bytes
+        static FBytes Uuid(const void *bytes)
+        {
+            FBytes b = {FBytes::UUID, static_cast<const unsigned char*>(bytes)};
+            return b;
+        }
+
+        // Quantity output in human-readable units
+        // The class is used in 'Bytes', 'Si' and 'Dur' methods (see below)
+        struct FUnits
+        {
+            enum Kind { BYTES, SI, DURATION };
+            Kind kind;
+            bool negative;
+            uint64_t magnitude;
+        };
+
+        /// Returns size argument output in binary units: '512 B', '12.3 MiB', '1.5 GiB'
+        /// The value is rounded to 3 significant digits, trailing fraction zeros are omitted.
+        /// The number has at most 3 whole digits: from 1000 to 1023 units the value is output
+        /// in the next unit ('0.977 MiB').
+        ///\param n - number of bytes
+        static FUnits Bytes(uint64_t n)
+        {
+            FUnits u = {FUnits::BYTES, false, n};
+            return u;
+        }
+
+        /// Returns value argument output with SI prefixes (k, M, G, T, P, E): '950', '4.5k', '12.3M'
+        /// The value is rounded to 3 significant digits, trailing fraction zeros are omitted.
+        /// For example, the rate may be output as "%?/s".
+        ///\param x - value
+        static FUnits Si(int64_t x)
+        {
+            FUnits u = {FUnits::SI, x < 0, x < 0 ? 0 - static_cast<uint64_t>(x) : static_cast<uint64_t>(x)};
+            return u;
+        }
+
+        /// Returns duration argument output in ns, us, ms or s: '750 ns', '1.23 ms', '42.5 s'
+        /// The value is rounded to 3 significant digits, trailing fraction zeros are omitted.
+        /// Durations from 1000 s are output in whole seconds: '3600 s', '86400 s'.
+        ///\param ns - duration in nanoseconds
+        static FUnits Dur(int64_t ns)
+        {
+            FUnits u = {FUnits::DURATION, ns < 0, ns < 0 ? 0 - static_cast<uint64_t>(ns) : static_cast<uint64_t>(ns)};
+            return u;
+        }
+
+        // Unsigned number output in hexadecimal digits
+        // The class is used in 'Hex' and 'Pointer' methods (see below)
+        struct FHex
+        {
+            uint64_t value;
+            bool prefix;
+        };
+
+        /// Returns argument for the output in lowercase hexadecimal digits without prefix ('1f'),
+        /// independently of the formatter flags.
+        ///\param value - number
+        ///\return The number which can be output
+        static FHex Hex(uint64_t value)
+        {
+            FHex h = {value, false};
+            return h;
+        }
+
+        /// Returns argument for the output of an address in the form '0x7f00a1b2c3d0' ('0x0' for nullptr),
+        /// independently of the formatter flags.
+        ///\param ptr - pointer
+        ///\return The address which can be output
+        static FHex Pointer(const void *ptr)
+        {
+            FHex h = {static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)), true};
+            return h;
+        }
+
+        // Floating-point number output with the given number of significant digits
+        // The class is used in 'Significant'-method (see below)
+        struct FSignificant
+        {
+            double value;
+            int digits;
+        };
+
+        /// Returns argument for the output with the given number of significant digits,
+        /// the same as the output with the default float field and precision 'digits' ('3.14', '1.23e+06'),
+        /// independently of the formatter flags and precision. The decimal point is taken from the formatter locale.
+        ///\param value - number
+        ///\param digits - number of significant digits (1 to 17)
+        ///\return The number which can be output
+        static FSignificant Significant(double value, int digits)
+        {
+            FSignificant f = {value, digits < 1 ? 1 : (digits > 17 ? 17 : digits)};
+            return f;
+        }
+
+        // Alignment of text in a column (see 'Width' and 'Column')
+        enum class Align
+        {
+            Left,
+            Right
+        };
+
+        // UTF-8 text fitted to display columns
+        // The class is used in 'Width', 'Truncate' and 'Column' methods (see below)
+        struct FText
+        {
+            const char *data;
+            size_t size;
+            size_t min_width;
+            size_t max_width;
+            Align align;
+        };
+
+        /// Returns UTF-8 text argument padded with spaces to the given display width.
+        /// The width is counted in terminal columns: East Asian wide characters and emoji take two columns,
+        /// combining marks take none. Text which is wider is output as is.
+        ///\param text - C-string, string, string_view etc.
+        ///\param width - minimum width in columns
+        ///\param align - alignment of the text: the spaces follow the left-aligned text and precede the right-aligned one
+        static FText Width(const char *text, size_t width, Align align = Align::Left)
+        {
+            return FText{text, std::char_traits<char>::length(text), width, static_cast<size_t>(-1), align};
+        }
+
+        template<typename Range,
+                typename = typename std::enable_if<std::is_same<typename CharRange<Range>::CharType, char>::value>::type>
+        static FText Width(const Range &text, size_t width, Align align = Align::Left)
+        {
+            return FText{text.data(), static_cast<size_t>(text.size()), width, static_cast<size_t>(-1), align};
+        }
+
+        /// Returns UTF-8 text argument truncated to the given display width.
+        /// The text is cut between user-perceived characters (a character with its combining marks,
+        /// an emoji sequence joined by ZWJ or a flag is never split).
+        ///\param text - C-string, string, string_view etc.
+        ///\param width - maximum width in columns
+        static FText Truncate(const char *text, size_t width)
+        {
+            return FText{text, std::char_traits<char>::length(text), 0, width, Align::Left};
+        }
+
+        template<typename Range,
+                typename = typename std::enable_if<std::is_same<typename CharRange<Range>::CharType, char>::value>::type>
+        static FText Truncate(const Range &text, size_t width)
+        {
+            return FText{text.data(), static_cast<size_t>(text.size()), 0, width, Align::Left};
+        }
+
+        /// Returns UTF-8 text argument which takes exactly the given display width (table column):
+        /// wider text is truncated, narrower one is padded with spaces.
+        ///\param text - C-string, string, string_view etc.
+        ///\param width - width in columns
+        ///\param align - alignment of the text
+        static FText Column(const char *text, size_t width, Align align = Align::Left)
+        {
+            return FText{text, std::char_traits<char>::length(text), width, width, align};
+        }
+
+        template<typename Range,
+                typename = typename std::enable_if<std::is_same<typename CharRange<Range>::CharType, char>::value>::type>
+        static FText Column(const Range &text, size_t width, Align align = Align::Left)
+        {
+            return FText{text.data(), static_cast<size_t>(text.size()), width, width, align};
+        }
+
+        // Nested format sequence with its arguments, rendered in place of the format specifier
+        // The class is used in 'Sub'-method (see below)
+        template<typename T, typename... Args>
+        struct FSub
+        {
+            const T *seq;
+            size_t size;
+            std::tuple<const Args&...> args;
+        };
+
+        /// Returns nested format argument: the sequence filled with its own arguments is output
+        /// directly into the output of the outer format, without intermediate strings.
+        /// The argument keeps references to the sequence and arguments, so it must be passed
+        /// to the format method directly. For example,
+        ///     formatter.Format("User %? logged in", formatter.Sub("%?@%?", name, host));
+        ///\param seq - pointer to nested sequence
+        ///\param args - list of nested arguments
+        ///\return The nested format argument
+        template<typename T, typename... Args>
+        static FSub<T, Args...> Sub(const T *seq, const Args&... args)
+        {
+            return FSub<T, Args...>{seq, std::char_traits<T>::length(seq), std::tuple<const Args&...>(args...)};
+        }
+
+        /// Returns nested format argument for contiguous range of characters (string, string_view etc.)
+        ///\param range - nested characters range
+        ///\param args - list of nested arguments
+        ///\return The nested format argument
+        template<typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        static FSub<T, Args...> Sub(const Range &range, const Args&... args)
+        {
+            return FSub<T, Args...>{range.data(), static_cast<size_t>(range.size()), std::tuple<const Args&...>(args...)};
+        }
+
+        // Proxy class for the output via 'operator<<'
+        // The class is used in 'Output'-method (see below)
+        // T is a reference type for wrapped lvalues and a value type for wrapped temporaries
+        template<typename T>
+        struct FWrapper
+        {
+            T t;
+        };
+
+        /// The helper-method for suppressing ambiguous overloading for output.
+        /// Returns a proxy-object which wraps a real object.
+        /// The proxy-object has its own operator<< which calls operator<< for the wrapped object directly, without SFINAE.
+        /// For example,
+        ///     SomeObject some_object;
+        ///     Formatter formatter;
+        ///     std::string result = formatter.format("String object value: %?", formatter.Output(some_object));
+        /// In this case the 'some_object' value will be output to the string directly via operator<<.
+        /// It is a simple way to avoid an ambiguous overloading, if occurs.
+        /// Lvalues are wrapped by reference (the proxy-object must not outlive them),
+        /// temporaries are moved into the proxy-object. So the wrapped type is never copied
+        /// and does not have to be default-constructible or copyable.
+        ///\param t - object for direct invoking operator<<
+        ///\return The proxy object which can be output
+        template<typename T>
+        FWrapper<T> Output(T &&t)
+        {
+            return FWrapper<T>{std::forward<T>(t)};
+        }
+
+    protected:
+        // Appends characters sequence filled with parameters converted by the policy to the output target
+        template<typename Policy, typename Target, typename T, typename... Args>
+        void FormatRangeWith(Target &target, const T* seq, size_t size, const Args&... args)
+        {
+            typedef SinkOf<Target> Adapter;
+            typename Adapter::Type sink(Adapter::Get(target));
+            typedef typename std::remove_reference<typename Adapter::Type>::type Sink;
+            ReserveSink(sink, size, 0);
+            Writer<T, Sink, Policy> out(*this, sink);
+            Render(out, seq, seq + size, args...);
+        }
+
+        // Appends compiled template filled with parameters converted by the policy to the output target
+        template<typename Policy, typename Target, typename T, typename... Args>
+        void FormatTemplateWith(Target &target, const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            typedef SinkOf<Target> Adapter;
+            typename Adapter::Type sink(Adapter::Get(target));
+            typedef typename std::remove_reference<typename Adapter::Type>::type Sink;
+            ReserveSink(sink, tmpl.m_source.size(), 0);
+            Writer<T, Sink, Policy> out(*this, sink);
+            RenderTemplate(out, tmpl, args...);
+        }
+
+        // Appends the prefix and characters sequence filled with parameters converted by the policy to the output target
+        template<typename Policy, typename Target, typename T, typename... Args>
+        void FormatPrefixedRangeWith(Target &target, const std::basic_string<T> &prefix,
+                                     const T* seq, size_t size, const Args&... args)
+        {
+            typedef SinkOf<Target> Adapter;
+            typename Adapter::Type sink(Adapter::Get(target));
+            typedef typename std::remove_reference<typename Adapter::Type>::type Sink;
+            ReserveSink(sink, prefix.size() + size, 0);
+            sink.Append(prefix.data(), prefix.size());
+            Writer<T, Sink, Policy> out(*this, sink);
+            Render(out, seq, seq + size, args...);
+        }
+
+        // Appends the prefix and compiled template filled with parameters converted by the policy to the output target
+        template<typename Policy, typename Target, typename T, typename... Args>
+        void FormatPrefixedTemplateWith(Target &target, const std::basic_string<T> &prefix,
+                                        const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            typedef SinkOf<Target> Adapter;
+            typename Adapter::Type sink(Adapter::Get(target));
+            typedef typename std::remove_reference<typename Adapter::Type>::type Sink;
+            ReserveSink(sink, prefix.size() + tmpl.m_source.size(), 0);
+            sink.Append(prefix.data(), prefix.size());
+            Writer<T, Sink, Policy> out(*this, sink);
+            RenderTemplate(out, tmpl, args...);
+        }
+
+    private:
+        // The format specifier
+        const char *SUBSTITUTE_MASK = "%?";
+
+        // Current locale for formatting
+        std::unique_ptr<std::locale> m_ptr_locale;
+        // Current set of flags for formatting
+        std::ios_base::fmtflags m_flags;
+        // Current precision for formatting of numeric values
+        std::streamsize m_precision;
+        // Current policy for UTF-8 text of string arguments
+        Utf8Mode m_utf8;
+
+        // Cached numeric punctuation of the current locale for narrow characters
+        struct NumPunct
+        {
+            char decimal_point;
+            char thousands_sep;
+            std::string grouping;
+            // Numbers are output without the stream: the locale has standard facets and no digit grouping
+            // (for narrow and wide characters, each by its own numpunct facet)
+            bool direct_numbers;
+            bool wide_direct_numbers;
+        };
+        NumPunct m_numpunct;
+
+        // Refreshes cached numeric punctuation after the locale change
+        void UpdateNumPunct()
+        {
+            const std::numpunct<char> &facet = std::use_facet<std::numpunct<char>>(*m_ptr_locale);
+            m_numpunct.decimal_point = facet.decimal_point();
+            m_numpunct.thousands_sep = facet.thousands_sep();
+            m_numpunct.grouping = facet.grouping();
+            m_numpunct.direct_numbers = m_numpunct.grouping.empty() && m_ptr_locale->name()!="*";
+            m_numpunct.wide_direct_numbers = m_ptr_locale->name()!="*" &&
+                    std::use_facet<std::numpunct<wchar_t>>(*m_ptr_locale).grouping().empty();
+        }
+
+        // Returns true if numbers in the output characters may be output without the stream
+        bool DirectNumbers(char) const
+        {
+            return m_numpunct.direct_numbers;
+        }
+
+        bool DirectNumbers(wchar_t) const
+        {
+            return m_numpunct.wide_direct_numbers;
+        }
+
+        // Returns numeric punctuation for the output character type:
+        // cached for narrow characters, taken from the locale for other ones
+        void GetNumPunct(char &decimal_point, char &thousands_sep, const std::string* &grouping) const
+        {
+            decimal_point = m_numpunct.decimal_point;
+            thousands_sep = m_numpunct.thousands_sep;
+            grouping = &m_numpunct.grouping;
+        }
+
+        template<typename T>
+        void GetNumPunct(T &decimal_point, T &thousands_sep, std::string &grouping_storage,
+                         const std::string* &grouping) const
+        {
+            const std::numpunct<T> &facet = std::use_facet<std::numpunct<T>>(*m_ptr_locale);
+            decimal_point = facet.decimal_point();
+            thousands_sep = facet.thousands_sep();
+            grouping_storage = facet.grouping();
+            grouping = &grouping_storage;
+        }
+
+        void GetNumPunct(char &decimal_point, char &thousands_sep, std::string&,
+                         const std::string* &grouping) const
+        {
+            GetNumPunct(decimal_point, thousands_sep, grouping);
+        }
+
+        // Writes digits of the unsigned value backwards, from the end of the buffer.
+        // Digits are grouped by the locale grouping rules (if thousands_sep is not null).
+        // Returns the pointer to the first written character.
+        template<typename T>
+        static T* WriteDigits(uint64_t value, T *end, const std::string *grouping = nullptr, T thousands_sep = T())
+        {
+            size_t group_index = 0;
+            int group_size = (grouping && !grouping->empty()) ? static_cast<int>((*grouping)[0]) : 0;
+            if(group_size==CHAR_MAX)
+                group_size = 0;
+            int count = 0;
+            do
+            {
+                if(group_size > 0 && count==group_size)
+                {
+                    *--end = thousands_sep;
+                    count = 0;
+                    if(group_index + 1 < grouping->size()) // The last group size is repeated
+                    {
+                        group_size = static_cast<int>((*grouping)[++group_index]);
+                        if(group_size==CHAR_MAX)
+                            group_size = 0;
+                    }
+                }
+                *--end = static_cast<T>('0' + static_cast<int>(value % 10));
+                value /= 10;
+                ++count;
+            }
+            while(value);
+            return end;
+        }
+
+        // Divides n by divisor rounding half-up to the given number of fraction digits
+        // Returns the quotient in units of the last fraction digit (i.e. 1234 for 12.34)
+        static uint64_t DivRound(uint64_t n, uint64_t divisor, unsigned decimals)
+        {
+            uint64_t quotient = n / divisor;
+            uint64_t remainder = n % divisor;
+            for(unsigned i = 0; i < decimals; ++i) // Long division: no overflow for divisors up to 10^18
+            {
+                quotient = quotient * 10 + remainder * 10 / divisor;
+                remainder = remainder * 10 % divisor;
+            }
+            if(remainder >= divisor - remainder)
+                ++quotient;
+            return quotient;
+        }
+
+        // Writes magnitude in the largest unit where it is less than 1000 (with base 1024 the values
+        // from 1000 to 1023 are output as fractions of the next unit: '0.977 MiB'),
+        // rounded to 3 significant digits without trailing fraction zeros.
+        // In the last unit all whole digits are written.
+        // Returns the position after the written characters.
+        template<typename T>
+        static T* WriteUnits(uint64_t magnitude, uint64_t base, const char* const *units, size_t units_count,
+                             T decimal_point, T *pos)
+        {
+            size_t unit = 0;
+            uint64_t divisor = 1;
+            while(unit + 1 < units_count && magnitude / divisor >= 1000)
+            {
+                divisor *= base;
+                ++unit;
+            }
+            unsigned decimals;
+            uint64_t rounded;
+            for(;;)
+            {
+                const uint64_t whole = magnitude / divisor;
+                decimals = (unit==0 || whole >= 100) ? 0 : (whole >= 10 ? 1 : (whole >= 1 ? 2 : 3));
+                rounded = DivRound(magnitude, divisor, decimals);
+                const uint64_t scale = decimals==0 ? 1 : (decimals==1 ? 10 : (decimals==2 ? 100 : 1000));
+                if(rounded / scale < 1000 || unit + 1==units_count) // Rounding may reach the next unit
+                    break;
+                divisor *= base;
+                ++unit;
+            }
+            for(; decimals > 0 && rounded % 10==0; --decimals)
+                rounded /= 10;
+            T digits[24];
+            T *digits_end = digits + sizeof(digits) / sizeof(digits[0]);
+            T *first = WriteDigits(rounded, digits_end);
+            // The whole part is zero only for a fraction of the next unit with base 1024
+            const size_t count = static_cast<size_t>(digits_end - first);
+            const size_t whole_count = count > decimals ? count - decimals : 0;
+            if(whole_count==0)
+                *pos++ = static_cast<T>('0');
+            std::copy(first, first + whole_count, pos);
+            pos += whole_count;
+            if(decimals > 0)
+            {
+                *pos++ = decimal_point;
+                for(size_t i = count; i < decimals; ++i)
+                    *pos++ = static_cast<T>('0');
+                std::copy(first + whole_count, digits_end, pos);
+                pos += count - whole_count;
+            }
+            for(const char *name = units[unit]; *name; ++name)
+                *pos++ = static_cast<T>(*name);
+            return pos;
+        }
+
+        // Returns table of lowercase hexadecimal pairs for all byte values: "000102...ff"
+        static const char* HexPairs()
+        {
+            static const char table[] =
+                "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+                "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+                "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+                "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+                "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+                "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+                "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+                "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+            return table;
+        }
+
+        // Writes bytes as hexadecimal pairs, a separator is written after the bytes with given indices
+        // (bit i of separators_mask) if the separator is not null.
+        // Returns the position after the written characters.
+        static char* WriteHex(const unsigned char *bytes, size_t size, char *pos,
+                              char separator = 0, unsigned separators_mask = 0)
+        {
+            const char *pairs = HexPairs();
+            for(size_t i = 0; i < size; ++i)
+            {
+                std::memcpy(pos, pairs + 2 * bytes[i], 2);
+                pos += 2;
+                if(separator && (separators_mask & (1u << i)))
+                    *pos++ = separator;
+            }
+            return pos;
+        }
+
+        // Writes IPv4 address as 'a.b.c.d'
+        // Returns the position after the written characters.
+        static char* WriteIPv4(const unsigned char *bytes, char *pos)
+        {
+            for(int i = 0; i < 4; ++i)
+            {
+                const unsigned v = bytes[i];
+                if(v >= 100)
+                {
+                    *pos++ = static_cast<char>('0' + v / 100);
+                    *pos++ = static_cast<char>('0' + v / 10 % 10);
+                }
+                else if(v >= 10)
+                {
+                    *pos++ = static_cast<char>('0' + v / 10);
+                }
+                *pos++ = static_cast<char>('0' + v % 10);
+                if(i < 3)
+                    *pos++ = '.';
+            }
+            return pos;
+        }
+
+        // Writes IPv6 address in the same form as inet_ntop does:
+        // the first longest run of two or more zero groups is replaced by '::',
+        // IPv4-mapped and IPv4-compatible addresses end with IPv4 dotted notation.
+        // Returns the position after the written characters.
+        static char* WriteIPv6(const unsigned char *bytes, char *pos)
+        {
+            unsigned words[8];
+            for(int i = 0; i < 8; ++i)
+                words[i] = (static_cast<unsigned>(bytes[2 * i]) << 8) | bytes[2 * i + 1];
+            int best_base = -1;
+            int best_len = 0;
+            for(int i = 0; i < 8; )
+            {
+                if(words[i]!=0)
+                {
+                    ++i;
+                    continue;
+                }
+                int j = i;
+                while(j < 8 && words[j]==0)
+                    ++j;
+                if(j - i > best_len)
+                {
+                    best_base = i;
+                    best_len = j - i;
+                }
+                i = j;
+            }
+            if(best_len < 2)
+                best_base = -1;
+            const char *pairs = HexPairs();
+            for(int i = 0; i < 8; ++i)
+            {
+                if(best_base!=-1 && i >= best_base && i < best_base + best_len)
+                {
+                    if(i==best_base)
+                        *pos++ = ':';
+                    continue;
+                }
+                if(i!=0)
+                    *pos++ = ':';
+                if(i==6 && best_base==0 && (best_len==6 || (best_len==5 && words[5]==0xffff)))
+                    return WriteIPv4(bytes + 12, pos);
+                // Hexadecimal group without leading zeros
+                const char *hi = pairs + 2 * bytes[2 * i];
+                const char *lo = pairs + 2 * bytes[2 * i + 1];
+                if(words[i] >= 0x1000)
+                    *pos++ = hi[0];
+                if(words[i] >= 0x100)
+                    *pos++ = hi[1];
+                if(words[i] >= 0x10)
+                    *pos++ = lo[0];
+                *pos++ = lo[1];
+            }
+            if(best_base!=-1 && best_base + best_len==8)
+                *pos++ = ':';
+            return pos;
+        }
+
+        // Writes decimal port number after the address: ':port'
+        // Returns the position after the written characters.
+        static char* WritePort(unsigned port, char *pos)
+        {
+            char digits[8];
+            char *end = digits + sizeof(digits);
+            char *first = WriteDigits(static_cast<uint64_t>(port), end);
+            *pos++ = ':';
+            std::memcpy(pos, first, static_cast<size_t>(end - first));
+            return pos + (end - first);
+        }
+
+        // Assigns locale, precision and flags for the given stream
+        template <typename Stream>
+        void AssignStreamSettings(Stream &stream) const
+        {
+            stream.precision(m_precision);
+            stream.imbue(*m_ptr_locale);
+            stream.flags(m_flags);
+        }
+
+        // Adapts output targets to sinks: strings and vectors are wrapped, other targets are sinks themselves
+        template<typename Target>
+        struct SinkOf
+        {
+            typedef Target& Type;
+
+            static Target& Get(Target &target)
+            {
+                return target;
+            }
+        };
+
+        template<typename T>
+        struct SinkOf<std::basic_string<T>>
+        {
+            typedef StringSink<T> Type;
+
+            static StringSink<T> Get(std::basic_string<T> &target)
+            {
+                return StringSink<T>(target);
+            }
+        };
+
+        template<typename T>
+        struct SinkOf<std::vector<T>>
+        {
+            typedef VectorSink<T> Type;
+
+            static VectorSink<T> Get(std::vector<T> &target)
+            {
+                return VectorSink<T>(target);
+            }
+        };
+
+        // Calls optional 'Reserve' of the sink
+        template<typename Sink>
+        static auto ReserveSink(Sink &sink, size_t size, int) -> decltype(sink.Reserve(size), void())
+        {
+            sink.Reserve(size);
+        }
+
+        template<typename Sink>
+        static void ReserveSink(Sink&, size_t, long)
+        { }
+
+        // Calls optional 'Flush' of the sink
+        template<typename Sink>
+        static auto FlushSink(Sink &sink, int) -> decltype(sink.Flush(), void())
+        {
+            sink.Flush();
+        }
+
+        template<typename Sink>
+        static void FlushSink(Sink&, long)
+        { }
+
+        // Streaming XXH64 hash (seed 0): the result does not depend on how the input is split into parts
+        class Xxh64
+        {
+            public:
+                Xxh64()
+                    : m_total(0),
+                      m_buffered(0)
+                {
+                    m_acc[0] = PRIME1 + PRIME2;
+                    m_acc[1] = PRIME2;
+                    m_acc[2] = 0;
+                    m_acc[3] = 0 - PRIME1;
+                }
+
+                void Update(const void *data, size_t size)
+                {
+                    const unsigned char *p = static_cast<const unsigned char*>(data);
+                    const unsigned char *end = p + size;
+                    m_total += size;
+                    if(m_buffered + size < 32)
+                    {
+                        if(size > 0)
+                            std::memcpy(m_buffer + m_buffered, p, size);
+                        m_buffered += size;
+                        return;
+                    }
+                    if(m_buffered > 0)
+                    {
+                        const size_t fill = 32 - m_buffered;
+                        std::memcpy(m_buffer + m_buffered, p, fill);
+                        Stripe(m_buffer);
+                        p += fill;
+                        m_buffered = 0;
+                    }
+                    for(; end - p >= 32; p += 32)
+                        Stripe(p);
+                    m_buffered = static_cast<size_t>(end - p);
+                    if(m_buffered > 0)
+                        std::memcpy(m_buffer, p, m_buffered);
+                }
+
+                uint64_t Digest() const
+                {
+                    uint64_t h;
+                    if(m_total >= 32)
+                    {
+                        h = Rotl(m_acc[0], 1) + Rotl(m_acc[1], 7) + Rotl(m_acc[2], 12) + Rotl(m_acc[3], 18);
+                        for(int i = 0; i < 4; ++i)
+                        {
+                            h ^= Round(0, m_acc[i]);
+                            h = h * PRIME1 + PRIME4;
+                        }
+                    }
+                    else
+                    {
+                        h = PRIME5;
+                    }
+                    h += m_total;
+                    const unsigned char *p = m_buffer;
+                    const unsigned char *end = m_buffer + m_buffered;
+                    for(; end - p >= 8; p += 8)
+                    {
+                        h ^= Round(0, Read64(p));
+                        h = Rotl(h, 27) * PRIME1 + PRIME4;
+                    }
+                    if(end - p >= 4)
+                    {
+                        h ^= Read32(p) * PRIME1;
+                        h = Rotl(h, 23) * PRIME2 + PRIME3;
+                        p += 4;
+                    }
+                    for(; p < end; ++p)
+                    {
+                        h ^= *p * PRIME5;
+                        h = Rotl(h, 11) * PRIME1;
+                    }
+                    h ^= h >> 33;
+                    h *= PRIME2;
+                    h ^= h >> 29;
+                    h *= PRIME3;
+                    h ^= h >> 32;
+                    return h;
+                }
+
+            private:
+                static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+                static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+                static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+                static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+                static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+                uint64_t m_acc[4];
+                uint64_t m_total;
+                unsigned char m_buffer[32];
+                size_t m_buffered;
+
+                static uint64_t Rotl(uint64_t x, int r)
+                {
+                    return (x << r) | (x >> (64 - r));
+                }
+
+                static uint64_t Round(uint64_t acc, uint64_t input)
+                {
+                    acc += input * PRIME2;
+                    return Rotl(acc, 31) * PRIME1;
+                }
+
+                // Little-endian reads independent of the platform byte order
+                static uint64_t Read64(const unsigned char *p)
+                {
+                    return Read32(p) | (Read32(p + 4) << 32);
+                }
+
+                static uint64_t Read32(const unsigned char *p)
+                {
+                    return static_cast<uint64_t>(p[0]) | (static_cast<uint64_t>(p[1]) << 8) |
+                           (static_cast<uint64_t>(p[2]) << 16) | (static_cast<uint64_t>(p[3]) << 24);
+                }
+
+                void Stripe(const unsigned char *p)
+                {
+                    for(int i = 0; i < 4; ++i)
+                        m_acc[i] = Round(m_acc[i], Read64(p + 8 * i));
+                }
+        };
+
+        // Output sink which hashes characters instead of storing them
+        template<typename T>
+        class HashSink
+        {
+            public:
+                void Append(const T *data, size_t size)
+                {
+                    m_hash.Update(data, size * sizeof(T));
+                }
+
+                uint64_t Digest() const
+                {
+                    return m_hash.Digest();
+                }
+
+            private:
+                Xxh64 m_hash;
+        };
+
+        // Output sink which compares characters with the expected string instead of storing them
+        template<typename T>
+        class CompareSink
+        {
+            public:
+                CompareSink(const T *expected, size_t size)
+                    : m_expected(expected),
+                      m_size(size),
+                      m_pos(0),
+                      m_equal(true)
+                { }
+
+                void Append(const T *data, size_t size)
+                {
+                    if(!m_equal)
+                        return;
+                    if(size > m_size - m_pos || std::char_traits<T>::compare(m_expected + m_pos, data, size)!=0)
+                    {
+                        m_equal = false;
+                        return;
+                    }
+                    m_pos += size;
+                }
+
+                bool Equal() const
+                {
+                    return m_equal && m_pos==m_size;
+                }
+
+            private:
+                const T *m_expected;
+                size_t m_size;
+                size_t m_pos;
+                bool m_equal;
+        };
+
+        // Output sink which stores characters of the coloured sequence without its escape sequences.
+        // Characters are appended from the sequence itself, so their positions tell whether they are escapes
+        template<typename T>
+        class UnstyledSink
+        {
+            public:
+                UnstyledSink(std::basic_string<T> &text, const T *sequence, const std::vector<bool> &escapes)
+                    : m_text(text),
+                      m_sequence(sequence),
+                      m_escapes(escapes)
+                { }
+
+                void Append(const T *data, size_t size)
+                {
+                    const size_t offset = static_cast<size_t>(data - m_sequence);
+                    for(size_t i = 0; i < size; ++i)
+                    {
+                        if(!m_escapes[offset + i])
+                            m_text += data[i];
+                    }
+                }
+
+            private:
+                std::basic_string<T> &m_text;
+                const T *m_sequence;
+                const std::vector<bool> &m_escapes;
+        };
+
+        // Unbuffered stream buffer which passes all characters to a sink.
+        // Allows to output values via operator<< directly into the sink, without intermediate strings
+        template<typename T, typename Sink>
+        class SinkBuffer : public std::basic_streambuf<T>
+        {
+            public:
+                typedef typename std::basic_streambuf<T>::int_type int_type;
+                typedef typename std::basic_streambuf<T>::traits_type traits_type;
+
+                explicit SinkBuffer(Sink &sink)
+                    : m_sink(sink)
+                { }
+
+            protected:
+                std::streamsize xsputn(const T *s, std::streamsize count) override
+                {
+                    m_sink.Append(s, static_cast<size_t>(count));
+                    return count;
+                }
+
+                int sync() override
+                {
+                    FlushSink(m_sink, 0);
+                    return 0;
+                }
+
+                int_type overflow(int_type ch) override
+                {
+                    if(!traits_type::eq_int_type(ch, traits_type::eof()))
+                    {
+                        const T c = traits_type::to_char_type(ch);
+                        m_sink.Append(&c, 1);
+                    }
+                    return traits_type::not_eof(ch);
+                }
+
+            private:
+                Sink &m_sink;
+        };
+
+        // Output of a single formatting call.
+        // Characters are appended to the sink directly.
+        // Values which are output via operator<< use a stream with the formatter settings,
+        // the stream writes into the same sink and is created only when it is needed.
+        // Policy converts the arguments and the elements of their values before the output.
+        template<typename T, typename Sink, typename Policy = DefaultFormatPolicy>
+        class Writer
+        {
+            public:
+                typedef T CharType;
+                typedef std::basic_ostream<T> StreamType;
+                typedef Policy PolicyType;
+
+                Writer(const Formatter &formatter, Sink &sink)
+                    : m_formatter(formatter),
+                      m_sink(sink),
+                      m_has_stream(false)
+                { }
+
+                ~Writer()
+                {
+                    if(m_has_stream)
+                        GetStreamState()->~StreamState();
+                }
+
+                Writer(const Writer&) = delete;
+                Writer& operator=(const Writer&) = delete;
+
+                void Append(const T *data, size_t size)
+                {
+                    if(size > 0)
+                        m_sink.Append(data, size);
+                }
+
+                void Append(T c)
+                {
+                    m_sink.Append(&c, 1);
+                }
+
+                // Appends null-terminated ASCII-text (punctuation, keywords) widened to the output character type
+                void Append(const char *text)
+                {
+                    AppendAscii(text, std::strlen(text));
+                }
+
+                // Appends ASCII-text of the given length widened to the output character type
+                void AppendAscii(const char *text, size_t size)
+                {
+                    AppendAscii(text, size, std::is_same<T, char>());
+                }
+
+                // Returns the stream which outputs values into the sink
+                StreamType& Stream()
+                {
+                    if(!m_has_stream)
+                    {
+                        StreamState *state = new (&m_stream_storage) StreamState(m_sink);
+                        m_has_stream = true;
+                        m_formatter.AssignStreamSettings(state->stream);
+                    }
+                    return GetStreamState()->stream;
+                }
+
+            private:
+                struct StreamState
+                {
+                    explicit StreamState(Sink &sink)
+                        : buffer(sink),
+                          stream(&buffer)
+                    { }
+
+                    SinkBuffer<T, Sink> buffer;
+                    StreamType stream;
+                };
+
+                const Formatter &m_formatter;
+                Sink &m_sink;
+                bool m_has_stream;
+                typename std::aligned_storage<sizeof(StreamState), alignof(StreamState)>::type m_stream_storage;
+
+                StreamState* GetStreamState()
+                {
+                    return reinterpret_cast<StreamState*>(&m_stream_storage);
+                }
+
+                void AppendAscii(const char *text, size_t size, std::true_type)
+                {
+                    m_sink.Append(reinterpret_cast<const T*>(text), size);
+                }
+
+                void AppendAscii(const char *text, size_t size, std::false_type)
+                {
+                    for(size_t i = 0; i < size; ++i)
+                        Append(static_cast<T>(text[i]));
+                }
+        };
+
+        // Copies the characters before the next format specifier to the output
+        // and moves 'first' past the specifier.
+        // Screened '%%?'-values are output as '%?'.
+        // Returns false if there are no more specifiers (the rest of the sequence is copied).
+        template<typename Out, typename T>
+        bool CopyLiteral(Out &out, const T* &first, const T *last)
+        {
+            const T mask_begin = static_cast<T>(SUBSTITUTE_MASK[0]);
+            const T mask_end = static_cast<T>(SUBSTITUTE_MASK[1]);
+            const T *pos = first;
+            while(pos < last)
+            {
+                pos = std::char_traits<T>::find(pos, static_cast<size_t>(last - pos), mask_begin);
+                if(pos==nullptr || last - pos < 2)
+                    break;
+                if(pos[1]!=mask_end)
+                {
+                    ++pos;
+                    continue;
+                }
+                if(pos > first && pos[-1]==mask_begin) // Ignore screened '%%?'-value
+                {
+                    out.Append(first, static_cast<size_t>(pos - first - 1));
+                    out.Append(pos, 2);
+                    first = pos += 2;
+                    continue;
+                }
+                out.Append(first, static_cast<size_t>(pos - first));
+                first = pos + 2;
+                return true;
+            }
+            out.Append(first, static_cast<size_t>(last - first));
+            first = last;
+            return false;
+        }
+
+        // Outputs the sequence [first, last) substituting the arguments in place of format specifiers.
+        // Sequence without arguments is output as is.
+        template<typename Out, typename T>
+        void Render(Out &out, const T *first, const T *last)
+        {
+            out.Append(first, static_cast<size_t>(last - first));
+        }
+
+        template<typename Out, typename T, typename... Args>
+        void Render(Out &out, const T *first, const T *last, const Args&... args)
+        {
+            Substitute(out, first, last, args...);
+        }
+
+        // Translates style markup (see 'CompileStyled') into the sequence of the coloured template.
+        // 'escapes' marks the characters of the escape sequences, which the plain template omits
+        template<typename T>
+        static void TranslateStyles(const T *seq, size_t size, std::basic_string<T> &colored, std::vector<bool> &escapes)
+        {
+            // Parameters of escape sequences for the started styles
+            std::vector<std::string> started;
+            const T *last = seq + size;
+            const T *pos = seq;
+            while(pos < last)
+            {
+                const T c = *pos;
+                if(c==static_cast<T>('{') && pos + 1 < last && pos[1]==static_cast<T>('{'))
+                {
+                    colored += c;
+                    escapes.push_back(false);
+                    pos += 2;
+                    continue;
+                }
+                std::string codes;
+                if(c==static_cast<T>('{'))
+                {
+                    const T *end = std::find(pos + 1, last, static_cast<T>('}'));
+                    if(end < last && end - pos==2 && pos[1]==static_cast<T>('/'))
+                    {
+                        if(!started.empty())
+                        {
+                            started.pop_back();
+                            AppendStyleReset(colored, started);
+                            escapes.resize(colored.size(), true);
+                        }
+                        pos = end + 1;
+                        continue;
+                    }
+                    if(end < last && ParseStyles(pos + 1, end, codes))
+                    {
+                        started.push_back(codes);
+                        AppendEscape(colored, codes);
+                        escapes.resize(colored.size(), true);
+                        pos = end + 1;
+                        continue;
+                    }
+                }
+                else if(c==static_cast<T>('%') && pos + 1 < last && pos[1]==static_cast<T>('<'))
+                {
+                    const T *end = std::find(pos + 2, last, static_cast<T>('>'));
+                    if(end + 1 < last && end[1]==static_cast<T>('?') && ParseStyles(pos + 2, end, codes))
+                    {
+                        AppendEscape(colored, codes);
+                        escapes.resize(colored.size(), true);
+                        colored += static_cast<T>('%');
+                        colored += static_cast<T>('?');
+                        escapes.resize(colored.size(), false);
+                        AppendStyleReset(colored, started);
+                        escapes.resize(colored.size(), true);
+                        pos = end + 2;
+                        continue;
+                    }
+                }
+                colored += c;
+                escapes.push_back(false);
+                ++pos;
+            }
+            if(!started.empty()) // Styles must not leak past the output
+            {
+                started.clear();
+                AppendStyleReset(colored, started);
+                escapes.resize(colored.size(), true);
+            }
+        }
+
+        // Parses comma-separated style names into parameters of the escape sequence ('1;31')
+        // Returns false if some name is unknown
+        template<typename T>
+        static bool ParseStyles(const T *first, const T *last, std::string &codes)
+        {
+            static const char* const names[] = {
+                "bold", "dim", "italic", "underline", "blink", "reverse", "strike",
+                "black", "red", "green", "yellow", "blue", "magenta", "cyan", "white", "gray",
+                "bright_red", "bright_green", "bright_yellow", "bright_blue", "bright_magenta", "bright_cyan", "bright_white",
+                "bg_black", "bg_red", "bg_green", "bg_yellow", "bg_blue", "bg_magenta", "bg_cyan", "bg_white"
+            };
+            static const char* const values[] = {
+                "1", "2", "3", "4", "5", "7", "9",
+                "30", "31", "32", "33", "34", "35", "36", "37", "90",
+                "91", "92", "93", "94", "95", "96", "97",
+                "40", "41", "42", "43", "44", "45", "46", "47"
+            };
+            codes.clear();
+            while(first <= last)
+            {
+                const T *end = std::find(first, last, static_cast<T>(','));
+                std::string name;
+                for(const T *c = first; c < end; ++c)
+                {
+                    if(*c < static_cast<T>(0x21) || *c > static_cast<T>(0x7E))
+                        return false;
+                    name += static_cast<char>(*c);
+                }
+                const char* const *found = std::find_if(names, names + sizeof(names) / sizeof(names[0]),
+                        [&name](const char *candidate) { return name==candidate; });
+                if(found==names + sizeof(names) / sizeof(names[0]))
+                    return false;
+                if(!codes.empty())
+                    codes += ';';
+                codes += values[found - names];
+                first = end + 1;
+            }
+            return true;
+        }
+
+        // Appends escape sequence 'ESC[<codes>m'
+        template<typename T>
+        static void AppendEscape(std::basic_string<T> &out, const std::string &codes)
+        {
+            out += static_cast<T>('\x1B');
+            out += static_cast<T>('[');
+            for(char c : codes)
+                out += static_cast<T>(c);
+            out += static_cast<T>('m');
+        }
+
+        // Resets all styles and starts again the styles which are still active
+        template<typename T>
+        static void AppendStyleReset(std::basic_string<T> &out, const std::vector<std::string> &started)
+        {
+            AppendEscape(out, "0");
+            for(const std::string &codes : started)
+                AppendEscape(out, codes);
+        }
+
+        // Outputs the compiled template filled with the arguments.
+        // Template without arguments is output as is (the same as the source sequence).
+        template<typename Out, typename T>
+        void RenderTemplate(Out &out, const BasicFormatTemplate<T> &tmpl)
+        {
+            out.Append(tmpl.m_source.data(), tmpl.m_source.size());
+        }
+
+        template<typename Out, typename T, typename... Args>
+        void RenderTemplate(Out &out, const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            RenderParts(out, tmpl, 0, args...);
+        }
+
+        // Outputs the literal parts of the compiled template separated by the arguments
+        // index - index of the current literal part
+        template<typename Out, typename T, typename V, typename... Args>
+        void RenderParts(Out &out, const BasicFormatTemplate<T> &tmpl, size_t index, const V &t, const Args&... args)
+        {
+            AppendPart(out, tmpl, index);
+            if(index + 1==tmpl.m_ends.size())
+                return;
+            OutputArgument(out, t);
+            RenderParts(out, tmpl, index + 1, args...);
+        }
+
+        // Outputs the rest of the compiled template when all arguments are output:
+        // odd format specifiers are output as '?'-characters
+        template<typename Out, typename T>
+        void RenderParts(Out &out, const BasicFormatTemplate<T> &tmpl, size_t index)
+        {
+            for(; index < tmpl.m_ends.size(); ++index)
+            {
+                AppendPart(out, tmpl, index);
+                if(index + 1 < tmpl.m_ends.size())
+                    out.Append(static_cast<T>('?'));
+            }
+        }
+
+        template<typename Out, typename T>
+        static void AppendPart(Out &out, const BasicFormatTemplate<T> &tmpl, size_t index)
+        {
+            const size_t begin = index==0 ? 0 : tmpl.m_ends[index - 1];
+            out.Append(tmpl.m_text.data() + begin, tmpl.m_ends[index] - begin);
+        }
+
+        // Outputs the next argument in place of the next format specifier
+        // first - current position in the sequence
+        // last - end of the sequence
+        // t - current argument
+        // args - other arguments
+        template<typename Out, typename T, typename V, typename... Args>
+        void Substitute(Out &out, const T *first, const T *last, const V &t, const Args&... args)
+        {
+            if(!CopyLiteral(out, first, last))
+                return;
+            OutputArgument(out, t);
+            Substitute(out, first, last, args...);
+        }
+
+        // Outputs the rest of the sequence when all arguments are output:
+        // odd format specifiers are output as '?'-characters
+        template<typename Out, typename T>
+        void Substitute(Out &out, const T *first, const T *last)
+        {
+            while(CopyLiteral(out, first, last))
+                out.Append(static_cast<T>('?'));
+        }
+
+        // Outputs an argument or an element of a value converted by the policy of the output.
+        // The conversion is selected by overloading at compile time, the default one returns the value itself.
+        template<typename Out, typename V>
+        void OutputArgument(Out &out, const V &t)
+        {
+            OutputValue(out, Out::PolicyType::Convert(t));
+        }
+
+        // Outputs type which has an 'operator<<', to the output
+        // out - output for the value
+        // t - type value
+        template<typename Out, typename T,
+                typename Output = decltype(std::declval<typename Out::StreamType&>() << std::declval<const T&>()),
+                typename = typename std::enable_if<!NativeOutput<T>::value>::type>
+        void OutputValue(Out &out, const T &t)
+        {
+            out.Stream() << t;
+        }
+
+        // Outputs type which can be iterated, to the output
+        // out - output for the value
+        // t - type value
+        template<typename Out, typename T,
+                typename It = typename T::const_iterator,
+                typename Type = typename T::value_type,
+                typename Begin = decltype(std::declval<T>().begin()),
+                typename End = decltype(std::declval<T>().end()),
+                typename = typename std::enable_if<!NativeOutput<T>::value>::type>
+        void OutputValue(Out &out, const T &t)
+        {
+            out.Append("[");
+            if(t.empty())
+            {
+                out.Append("]");
+                return;
+            }
+            It last = --t.end();
+            for(It it=t.begin(); it!=t.end(); ++it)
+            {
+                OutputArgument(out, *it);
+                if(it!=last)
+                    out.Append(", ");
+            }
+            out.Append("]");
+        }
+
+        // Outputs string-like values (basic_string, basic_string_view) by copying characters directly
+        // out - output for the value
+        // str - string value
+        template<typename Out, typename T,
+                typename = typename std::enable_if<StringLike<T>::value>::type>
+        void OutputValue(Out &out, const T &str)
+        {
+            OutputText(out, str.data(), static_cast<size_t>(str.size()));
+        }
+
+        // Outputs null-terminated character sequences (char*, wchar_t* etc.)
+        // out - output for the value
+        // str - pointer to the first character
+        template<typename Out, typename C,
+                typename = typename std::enable_if<IsChar<typename std::remove_const<C>::type>::value>::type>
+        void OutputValue(Out &out, C *str)
+        {
+            typedef typename std::remove_const<C>::type Char;
+            OutputText(out, str, std::char_traits<Char>::length(str));
+        }
+
+        // Outputs the object wrapped by the proxy-object via operator<< into the output stream
+        // out - output for the value
+        // fw - proxy-object (see method 'Output')
+        template<typename Out, typename T>
+        void OutputValue(Out &out, const FWrapper<T> &fw)
+        {
+            out.Stream() << fw.t;
+        }
+
+        // Outputs pair-values in braces to the output
+        // out - output for the value
+        // value - pair value
+        template<typename Out, typename T, typename V>
+        void OutputValue(Out &out, const std::pair<T,V> &value)
+        {
+            out.Append("{");
+            OutputArgument(out, value.first);
+            out.Append(" : ");
+            OutputArgument(out, value.second);
+            out.Append("}");
+        }
+
+        // Outputs tuple-values in braces to the output: '{a, b, c}'
+        // out - output for the value
+        // value - tuple value
+        template<typename Out, typename... Types>
+        void OutputValue(Out &out, const std::tuple<Types...> &value)
+        {
+            out.Append("{");
+            OutputTupleElements(out, value, std::integral_constant<size_t, 0>());
+            out.Append("}");
+        }
+
+        // Outputs tuple elements starting from the element with index I
+        template<typename Out, typename Tuple, size_t I>
+        void OutputTupleElements(Out &out, const Tuple &value, std::integral_constant<size_t, I>)
+        {
+            if(I > 0)
+                out.Append(", ");
+            OutputArgument(out, std::get<I>(value));
+            OutputTupleElements(out, value, std::integral_constant<size_t,
+                    (I + 1 < std::tuple_size<Tuple>::value ? I + 1 : std::tuple_size<Tuple>::value)>());
+        }
+
+        template<typename Out, typename... Types>
+        void OutputTupleElements(Out&, const std::tuple<Types...>&, std::integral_constant<size_t, sizeof...(Types)>)
+        { }
+
+        // Outputs the pointed object for non-empty smart pointers and 'null' for empty ones.
+        // Pointers to void are output as addresses, pointers to incomplete types cannot be output.
+        // out - output for the value
+        // ptr - smart pointer
+        template<typename Out, typename T, typename D,
+                typename = typename std::enable_if<!std::is_array<T>::value>::type>
+        void OutputValue(Out &out, const std::unique_ptr<T, D> &ptr)
+        {
+            OutputPointee(out, ptr.get(), Dereferenceable<T>());
+        }
+
+        template<typename Out, typename T,
+                typename = typename std::enable_if<!std::is_array<T>::value>::type>
+        void OutputValue(Out &out, const std::shared_ptr<T> &ptr)
+        {
+            OutputPointee(out, ptr.get(), Dereferenceable<T>());
+        }
+
+        template<typename Out, typename T>
+        void OutputPointee(Out &out, const T *ptr, std::true_type)
+        {
+            if(ptr)
+                OutputArgument(out, *ptr);
+            else
+                out.Append("null");
+        }
+
+        template<typename Out, typename P>
+        void OutputPointee(Out &out, P ptr, std::false_type)
+        {
+            OutputArgument(out, static_cast<const void*>(ptr));
+        }
+
+#if FORMAT_UTIL_CPP17
+        // Outputs the contained value of optional-values and 'null' for empty ones
+        // out - output for the value
+        // value - optional value
+        template<typename Out, typename T>
+        void OutputValue(Out &out, const std::optional<T> &value)
+        {
+            if(value)
+                OutputArgument(out, *value);
+            else
+                out.Append("null");
+        }
+
+        template<typename Out>
+        void OutputValue(Out &out, std::nullopt_t)
+        {
+            out.Append("null");
+        }
+
+        // Outputs the currently held alternative of variant-values.
+        // Variant which is valueless by exception is output as unknown value.
+        // out - output for the value
+        // value - variant value
+        template<typename Out, typename... Types>
+        void OutputValue(Out &out, const std::variant<Types...> &value)
+        {
+            if(value.valueless_by_exception())
+            {
+                out.Append("?");
+                return;
+            }
+            std::visit([this, &out](const auto &alternative) { OutputArgument(out, alternative); }, value);
+        }
+
+        template<typename Out>
+        void OutputValue(Out &out, std::monostate)
+        {
+            out.Append("null");
+        }
+#endif
+
+        // Outputs names of enumeration values registered via FORMAT_UTIL_ENUM-macro.
+        // Unregistered values are output as numbers.
+        // out - output for the value
+        // value - enumeration value
+        template<typename Out, typename E,
+                typename std::enable_if<RegisteredEnum<E>::value, int>::type = 0>
+        void OutputValue(Out &out, const E &value)
+        {
+            const char *name = nullptr;
+            size_t size = 0;
+            typedef typename std::underlying_type<E>::type U;
+            if(FormatterEnum<E>::Table().Find(static_cast<U>(value), name, size))
+                out.AppendAscii(name, size);
+            else
+                out.Stream() << +static_cast<U>(value); // Promoted: character types are output as numbers
+        }
+
+        // Outputs fixed-point decimal values by integer arithmetic (see method 'Decimal')
+        // out - output for the value
+        // d - decimal value
+        template<typename Out>
+        void OutputValue(Out &out, const FDecimal &d)
+        {
+            typedef typename Out::CharType T;
+            T decimal_point;
+            T thousands_sep;
+            std::string grouping_storage;
+            const std::string *grouping;
+            GetNumPunct(decimal_point, thousands_sep, grouping_storage, grouping);
+            // Sign, 20 grouped digits, decimal point and 20 fraction digits
+            T buffer[64];
+            T *end = buffer + sizeof(buffer) / sizeof(buffer[0]);
+            T *pos = end;
+            uint64_t magnitude = d.value < 0 ? 0 - static_cast<uint64_t>(d.value) : static_cast<uint64_t>(d.value);
+            // The magnitude has at most 20 digits, other fraction digits are leading zeros
+            const unsigned digits = d.scale < 20 ? d.scale : 20;
+            for(unsigned i = 0; i < digits; ++i)
+            {
+                *--pos = static_cast<T>('0' + static_cast<int>(magnitude % 10));
+                magnitude /= 10;
+            }
+            T *fraction = pos;
+            if(d.scale > 0 || (m_flags & std::ios_base::showpoint))
+                *--pos = decimal_point;
+            pos = WriteDigits(magnitude, pos, grouping, thousands_sep);
+            if(d.value < 0)
+                *--pos = static_cast<T>('-');
+            else if(m_flags & std::ios_base::showpos)
+                *--pos = static_cast<T>('+');
+            if(d.scale==digits)
+            {
+                out.Append(pos, static_cast<size_t>(end - pos));
+                return;
+            }
+            out.Append(pos, static_cast<size_t>(fraction - pos));
+            static const char zeros[] = "00000000000000000000000000000000";
+            for(unsigned left = d.scale - digits; left > 0; )
+            {
+                const unsigned size = left < 32 ? left : 32;
+                out.AppendAscii(zeros, size);
+                left -= size;
+            }
+            out.Append(fraction, static_cast<size_t>(end - fraction));
+        }
+
+        // Outputs binary identifiers: IP addresses, MAC addresses, UUIDs (see method 'IPv4' etc.)
+        // out - output for the value
+        // b - identifier bytes
+        template<typename Out>
+        void OutputValue(Out &out, const FBytes &b)
+        {
+            char buffer[64];
+            char *pos = buffer;
+            switch(b.kind)
+            {
+                case FBytes::IPV4:
+                    pos = WriteIPv4(b.bytes, pos);
+                    break;
+                case FBytes::IPV6:
+                    pos = WriteIPv6(b.bytes, pos);
+                    break;
+                case FBytes::MAC:
+                    pos = WriteHex(b.bytes, 6, pos, ':', 0x1f);
+                    break;
+                case FBytes::UUID:
+                    pos = WriteHex(b.bytes, 16, pos, '-', (1u << 3) | (1u << 5) | (1u << 7) | (1u << 9));
+                    break;
+            }
+            out.AppendAscii(buffer, static_cast<size_t>(pos - buffer));
+        }
+
+#ifdef FORMAT_UTIL_NETWORK
+        // Outputs IPv4 address as 'a.b.c.d'
+        template<typename Out>
+        void OutputValue(Out &out, const in_addr &addr)
+        {
+            OutputValue(out, IPv4(&addr));
+        }
+
+        // Outputs IPv6 address in the same form as inet_ntop does
+        template<typename Out>
+        void OutputValue(Out &out, const in6_addr &addr)
+        {
+            OutputValue(out, IPv6(&addr));
+        }
+
+        // Outputs IPv4 socket address as 'a.b.c.d:port' ('a.b.c.d' if the port is 0)
+        template<typename Out>
+        void OutputValue(Out &out, const sockaddr_in &addr)
+        {
+            char buffer[32];
+            char *pos = WriteIPv4(reinterpret_cast<const unsigned char*>(&addr.sin_addr), buffer);
+            if(addr.sin_port!=0)
+                pos = WritePort(ntohs(addr.sin_port), pos);
+            out.AppendAscii(buffer, static_cast<size_t>(pos - buffer));
+        }
+
+        // Outputs IPv6 socket address as '[address]:port' ('address' if the port is 0)
+        template<typename Out>
+        void OutputValue(Out &out, const sockaddr_in6 &addr)
+        {
+            char buffer[64];
+            char *pos = buffer;
+            if(addr.sin6_port!=0)
+                *pos++ = '[';
+            pos = WriteIPv6(reinterpret_cast<const unsigned char*>(&addr.sin6_addr), pos);
+            if(addr.sin6_port!=0)
+            {
+                *pos++ = ']';
+                pos = WritePort(ntohs(addr.sin6_port), pos);
+            }
+            out.AppendAscii(buffer, static_cast<size_t>(pos - buffer));
+        }
+
+        // Outputs socket address of IPv4 or IPv6 family, other families are unknown for the output
+        template<typename Out>
+        void OutputValue(Out &out, const sockaddr_storage &addr)
+        {
+            if(addr.ss_family==AF_INET)
+                OutputValue(out, *reinterpret_cast<const sockaddr_in*>(&addr));
+            else if(addr.ss_family==AF_INET6)
+                OutputValue(out, *reinterpret_cast<const sockaddr_in6*>(&addr));
+            else
+                out.Append("?");
+        }
+#endif
+
+        // Outputs quantities in human-readable units (see methods 'Bytes', 'Si' and 'Dur')
+        // out - output for the value
+        // u - quantity
+        template<typename Out>
+        void OutputValue(Out &out, const FUnits &u)
+        {
+            typedef typename Out::CharType T;
+            static const char* const bytes_units[] = {" B", " KiB", " MiB", " GiB", " TiB", " PiB", " EiB"};
+            static const char* const si_units[] = {"", "k", "M", "G", "T", "P", "E"};
+            static const char* const duration_units[] = {" ns", " us", " ms", " s"};
+            T decimal_point;
+            T thousands_sep;
+            std::string grouping_storage;
+            const std::string *grouping;
+            GetNumPunct(decimal_point, thousands_sep, grouping_storage, grouping);
+            T buffer[48];
+            T *pos = buffer;
+            if(u.negative)
+                *pos++ = static_cast<T>('-');
+            switch(u.kind)
+            {
+                case FUnits::BYTES:
+                    pos = WriteUnits(u.magnitude, 1024, bytes_units, 7, decimal_point, pos);
+                    break;
+                case FUnits::SI:
+                    pos = WriteUnits(u.magnitude, 1000, si_units, 7, decimal_point, pos);
+                    break;
+                case FUnits::DURATION:
+                    pos = WriteUnits(u.magnitude, 1000, duration_units, 4, decimal_point, pos);
+                    break;
+            }
+            out.Append(buffer, static_cast<size_t>(pos - buffer));
+        }
+
+        // Outputs numbers in hexadecimal digits (see methods 'Hex' and 'Pointer')
+        // out - output for the value
+        // h - number
+        template<typename Out>
+        void OutputValue(Out &out, const FHex &h)
+        {
+            char buffer[24];
+            char *end = buffer + sizeof(buffer);
+            char *pos = end;
+            uint64_t value = h.value;
+            do
+            {
+                *--pos = "0123456789abcdef"[value & 0xF];
+                value >>= 4;
+            }
+            while(value!=0);
+            if(h.prefix)
+            {
+                *--pos = 'x';
+                *--pos = '0';
+            }
+            out.AppendAscii(pos, static_cast<size_t>(end - pos));
+        }
+
+        // Outputs floating-point numbers with the given number of significant digits (see method 'Significant')
+        // out - output for the value
+        // f - number
+        template<typename Out>
+        void OutputValue(Out &out, const FSignificant &f)
+        {
+            char text[32];
+            const int written = std::snprintf(text, sizeof(text), "%.*g", f.digits, f.value);
+            const size_t size = static_cast<size_t>(written > 0 ? written : 0);
+            typename Out::CharType buffer[32];
+            WidenNumber(text, size, buffer);
+            out.Append(buffer, size);
+        }
+
+        // Outputs nested format sequence filled with its arguments (see method 'Sub')
+        // out - output for the value
+        // sub - nested format
+        // Nested sequence of other character type than the output is unknown for the output
+        template<typename Out, typename T, typename... Args>
+        void OutputValue(Out &out, const FSub<T, Args...> &sub)
+        {
+            RenderSub(out, sub, typename MakeIndices<sizeof...(Args)>::type(),
+                      std::is_same<T, typename Out::CharType>());
+        }
+
+        template<typename Out, typename T, typename... Args, size_t... I>
+        void RenderSub(Out &out, const FSub<T, Args...> &sub, Indices<I...>, std::true_type)
+        {
+            Render(out, sub.seq, sub.seq + sub.size, std::get<I>(sub.args)...);
+        }
+
+        template<typename Out, typename Sub, typename Ind>
+        void RenderSub(Out &out, const Sub&, Ind, std::false_type)
+        {
+            out.Append("?");
+        }
+
+        // Outputs text fitted to display columns (UTF-8 text is output only into narrow characters)
+        // out - output for the value
+        // t - text with its width limits (see 'Width', 'Truncate' and 'Column')
+        template<typename Out>
+        void OutputValue(Out &out, const FText &t)
+        {
+            OutputColumns(out, t, std::is_same<typename Out::CharType, char>());
+        }
+
+        template<typename Out>
+        void OutputColumns(Out &out, const FText &t, std::true_type)
+        {
+            size_t width;
+            const size_t size = FitColumns(reinterpret_cast<const unsigned char*>(t.data), t.size, t.max_width, width);
+            const size_t padding = width < t.min_width ? t.min_width - width : 0;
+            if(t.align==Align::Right)
+                AppendSpaces(out, padding);
+            OutputText(out, t.data, size);
+            if(t.align==Align::Left)
+                AppendSpaces(out, padding);
+        }
+
+        template<typename Out>
+        void OutputColumns(Out &out, const FText&, std::false_type)
+        {
+            out.Append("?");
+        }
+
+        template<typename Out>
+        static void AppendSpaces(Out &out, size_t count)
+        {
+            static const char spaces[] = "                                ";
+            const size_t block = sizeof(spaces) - 1;
+            for(; count > block; count -= block)
+                out.AppendAscii(spaces, block);
+            out.AppendAscii(spaces, count);
+        }
+
+        // Returns size of the longest prefix of UTF-8 text which fits into the given display width
+        // without splitting user-perceived characters, 'width' is set to the display width of the prefix
+        static size_t FitColumns(const unsigned char *text, size_t size, size_t max_width, size_t &width)
+        {
+            // ASCII characters take one column each
+            const size_t ascii = AsciiPrefix(text, size);
+            if(ascii==size || ascii > max_width)
+            {
+                width = ascii < max_width ? ascii : max_width;
+                return width;
+            }
+            // The last ASCII character may start a character with combining marks
+            size_t pos = ascii > 0 ? ascii - 1 : 0;
+            width = pos;
+            while(pos < size)
+            {
+                size_t next;
+                const size_t cluster_width = NextCluster(text, pos, size, next);
+                if(width + cluster_width > max_width)
+                    break;
+                width += cluster_width;
+                pos = next;
+            }
+            return pos;
+        }
+
+        // Finds the end of the user-perceived character (extended grapheme cluster, simplified)
+        // which starts at 'pos': a character followed by combining marks, variation selectors,
+        // emoji modifiers and characters joined by ZWJ, or a pair of regional indicators (flag).
+        // Returns the display width of the cluster, 'next' is set to its end.
+        static size_t NextCluster(const unsigned char *text, size_t pos, size_t size, size_t &next)
+        {
+            const uint32_t first = DecodeUtf8(text, pos, size, next);
+            const size_t width = CharWidth(first);
+            bool regional = first >= 0x1F1E6 && first <= 0x1F1FF;
+            while(next < size)
+            {
+                size_t after;
+                const uint32_t c = DecodeUtf8(text, next, size, after);
+                if(c==0x200D) // ZWJ joins the next character
+                {
+                    next = after;
+                    if(next < size)
+                        DecodeUtf8(text, next, size, next);
+                }
+                else if(regional && c >= 0x1F1E6 && c <= 0x1F1FF)
+                {
+                    next = after;
+                    regional = false;
+                }
+                else if(c >= 0x80 && CharWidth(c)==0)
+                    next = after;
+                else
+                    break;
+            }
+            return width;
+        }
+
+        // Decodes UTF-8 character at 'pos', 'next' is set to the position after it.
+        // Invalid byte is decoded as U+FFFD.
+        static uint32_t DecodeUtf8(const unsigned char *text, size_t pos, size_t size, size_t &next)
+        {
+            const unsigned char lead = text[pos];
+            if(lead < 0x80)
+            {
+                next = pos + 1;
+                return lead;
+            }
+            size_t length;
+            if(!Utf8Sequence(text + pos, size - pos, length))
+            {
+                next = pos + length;
+                return 0xFFFD;
+            }
+            next = pos + length;
+            uint32_t c = lead & (0x7F >> length);
+            for(size_t i = 1; i < length; ++i)
+                c = (c << 6) | (text[pos + i] & 0x3F);
+            return c;
+        }
+
+        // Returns display width of the character: 0, 1 or 2 columns
+        static size_t CharWidth(uint32_t c)
+        {
+            if(c < 0x80) // ASCII characters take one column each (as in the fast path)
+                return 1;
+            if(c < 0xA0)
+                return 0;
+            if(c < 0x300)
+                return 1;
+            if((c >= 0x4E00 && c <= 0x9FFF) || (c >= 0xAC00 && c <= 0xD7A3)) // CJK ideographs and Hangul syllables
+                return 2;
+            // Ranges of zero-width characters: combining marks, format characters, variation selectors, emoji modifiers
+            static const uint32_t zero_width[][2] = {
+                {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+                {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x061C, 0x061C}, {0x064B, 0x065F},
+                {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED},
+                {0x0711, 0x0711}, {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x0816, 0x082D},
+                {0x0859, 0x085B}, {0x0898, 0x089F}, {0x08CA, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C},
+                {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+                {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x09E2, 0x09E3}, {0x0A01, 0x0A02},
+                {0x0A3C, 0x0A3C}, {0x0A41, 0x0A51}, {0x0A70, 0x0A71}, {0x0A75, 0x0A75}, {0x0A81, 0x0A82},
+                {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8}, {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3}, {0x0B01, 0x0B01},
+                {0x0B3C, 0x0B3C}, {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D}, {0x0B82, 0x0B82},
+                {0x0BC0, 0x0BC0}, {0x0BCD, 0x0BCD}, {0x0C00, 0x0C00}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C56},
+                {0x0CBC, 0x0CBC}, {0x0CCC, 0x0CCD}, {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0DCA, 0x0DCA},
+                {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1},
+                {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECE}, {0x0F18, 0x0F19}, {0x0F35, 0x0F35}, {0x0F37, 0x0F37},
+                {0x0F39, 0x0F39}, {0x0F71, 0x0F7E}, {0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F8D, 0x0FBC},
+                {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x1160, 0x11FF}, {0x135D, 0x135F},
+                {0x1712, 0x1714}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3},
+                {0x180B, 0x180F}, {0x1A56, 0x1A56}, {0x1A58, 0x1A7F}, {0x1AB0, 0x1AFF}, {0x1B00, 0x1B03},
+                {0x1B34, 0x1B34}, {0x1B36, 0x1B3A}, {0x1B6B, 0x1B73}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+                {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1}, {0x2DE0, 0x2DFF},
+                {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672}, {0xA674, 0xA67D}, {0xA69E, 0xA69F},
+                {0xA6F0, 0xA6F1}, {0xA8E0, 0xA8F1}, {0xD7B0, 0xD7FF}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F},
+                {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x101FD, 0x101FD}, {0x1D167, 0x1D169}, {0x1D173, 0x1D182},
+                {0x1F3FB, 0x1F3FF}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F}, {0xE0100, 0xE01EF}
+            };
+            // Ranges of wide characters (East Asian Wide and Fullwidth, emoji presentation)
+            static const uint32_t wide[][2] = {
+                {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+                {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+                {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+                {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+                {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+                {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+                {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+                {0x2E80, 0x303E}, {0x3041, 0x3247}, {0x3250, 0x4DBF}, {0x4E00, 0xA4CF}, {0xA960, 0xA97F},
+                {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60},
+                {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x16FF0, 0x16FF1}, {0x17000, 0x18CD5}, {0x18D00, 0x18D08},
+                {0x1AFF0, 0x1B2FB}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+                {0x1F1E6, 0x1F1FF}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251},
+                {0x1F260, 0x1F265}, {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393},
+                {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F3FA},
+                {0x1F400, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+                {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+                {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6DC, 0x1F6DF},
+                {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0}, {0x1F90C, 0x1F93A},
+                {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+            };
+            if(InRanges(c, zero_width, sizeof(zero_width) / sizeof(zero_width[0])))
+                return 0;
+            return InRanges(c, wide, sizeof(wide) / sizeof(wide[0])) ? 2 : 1;
+        }
+
+        // Binary search of the character in sorted ranges
+        static bool InRanges(uint32_t c, const uint32_t (*ranges)[2], size_t count)
+        {
+            if(c < ranges[0][0] || c > ranges[count - 1][1])
+                return false;
+            size_t low = 0;
+            size_t high = count;
+            while(low < high)
+            {
+                const size_t middle = (low + high) / 2;
+                if(c > ranges[middle][1])
+                    low = middle + 1;
+                else if(c < ranges[middle][0])
+                    high = middle;
+                else
+                    return true;
+            }
+            return false;
+        }
+
+        // Outputs integers in decimal digits without the stream if the flags and the locale allow it
+        // (the output is the same as the output via the stream)
+        // out - output for the value
+        // value - integer value
+        template<typename Out, typename V,
+                typename std::enable_if<Number<V>::value && std::is_integral<V>::value, int>::type = 0>
+        void OutputValue(Out &out, const V &value)
+        {
+            if(!DirectNumbers(typename Out::CharType()) ||
+               (m_flags & (std::ios_base::basefield | std::ios_base::showpos)) & ~std::ios_base::dec)
+            {
+                out.Stream() << value;
+                return;
+            }
+            char buffer[24];
+#if FORMAT_UTIL_TO_CHARS
+            const char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            AppendNumber(out, value, buffer, static_cast<size_t>(end - buffer));
+#else
+            char *end = buffer + sizeof(buffer);
+            const bool negative = IsNegative(value, std::is_signed<V>());
+            char *pos = WriteDigits(negative ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value), end);
+            if(negative)
+                *--pos = '-';
+            AppendNumber(out, value, pos, static_cast<size_t>(end - pos));
+#endif
+        }
+
+        template<typename V>
+        static bool IsNegative(V value, std::true_type)
+        {
+            return value < 0;
+        }
+
+        template<typename V>
+        static bool IsNegative(V, std::false_type)
+        {
+            return false;
+        }
+
+        // Outputs float and double values without the stream if the flags and the locale allow it
+        // (the output is the same as the output via the stream: float is output as double)
+        // out - output for the value
+        // value - floating-point value
+        template<typename Out, typename V,
+                typename std::enable_if<Number<V>::value && std::is_floating_point<V>::value, int>::type = 0>
+        void OutputValue(Out &out, const V &value)
+        {
+            const std::ios_base::fmtflags floatfield = m_flags & std::ios_base::floatfield;
+            if(!DirectNumbers(typename Out::CharType()) || floatfield==std::ios_base::floatfield ||
+               (m_flags & (std::ios_base::showpos | std::ios_base::showpoint | std::ios_base::uppercase)) ||
+               m_precision < 0 || m_precision > 100 ||
+               !OutputDouble(out, static_cast<double>(value), floatfield))
+            {
+                out.Stream() << value;
+            }
+        }
+
+        // Converts the value in the same way as printf with '%.*g', '%.*f' or '%.*e' and the formatter precision.
+        // Returns false if the result does not fit the buffer.
+        template<typename Out>
+        bool OutputDouble(Out &out, double value, std::ios_base::fmtflags floatfield)
+        {
+            char text[128];
+#if FORMAT_UTIL_TO_CHARS
+            const std::chars_format format = floatfield==std::ios_base::fixed ? std::chars_format::fixed :
+                    (floatfield==std::ios_base::scientific ? std::chars_format::scientific : std::chars_format::general);
+            const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value, format,
+                                                              static_cast<int>(m_precision));
+            if(result.ec!=std::errc())
+                return false;
+            const size_t size = static_cast<size_t>(result.ptr - text);
+#else
+            const char *spec = floatfield==std::ios_base::fixed ? "%.*f" :
+                    (floatfield==std::ios_base::scientific ? "%.*e" : "%.*g");
+            const int written = std::snprintf(text, sizeof(text), spec, static_cast<int>(m_precision), value);
+            if(written < 0 || static_cast<size_t>(written) >= sizeof(text))
+                return false;
+            const size_t size = static_cast<size_t>(written);
+#endif
+            typename Out::CharType buffer[128];
+            WidenNumber(text, size, buffer);
+            AppendNumber(out, value, buffer, size);
+            return true;
+        }
+
+        // Converts number text to the output characters replacing the decimal point by the one of the formatter locale
+        // (snprintf writes the decimal point of the global C locale)
+        template<typename T>
+        void WidenNumber(const char *text, size_t size, T *buffer) const
+        {
+            T decimal_point;
+            T thousands_sep;
+            std::string grouping_storage;
+            const std::string *grouping;
+            GetNumPunct(decimal_point, thousands_sep, grouping_storage, grouping);
+            for(size_t i = 0; i < size; ++i)
+            {
+                const char c = text[i];
+                const bool number_char = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c=='-' || c=='+';
+                buffer[i] = number_char ? static_cast<T>(c) : decimal_point;
+            }
+        }
+
+        // Appends number converted without the stream (ASCII text or text in the output characters).
+        // With FORMAT_UTIL_VERIFY the text is compared with the stream output first.
+        template<typename Out, typename V, typename C>
+        void AppendNumber(Out &out, const V &value, const C *text, size_t size)
+        {
+#if FORMAT_UTIL_VERIFY
+            typedef typename Out::CharType T;
+            std::basic_ostringstream<T> reference;
+            AssignStreamSettings(reference);
+            reference << value;
+            const std::basic_string<T> expected = reference.str();
+            bool equal = expected.size()==size;
+            for(size_t i = 0; equal && i < size; ++i)
+                equal = expected[i]==static_cast<T>(text[i]);
+            if(!equal)
+            {
+                RecordMismatch(value, expected.data(), expected.size(), text, size);
+                out.Append(expected.data(), expected.size());
+                return;
+            }
+#else
+            (void)value;
+#endif
+            AppendNumberText(out, text, size, std::is_same<C, char>());
+        }
+
+        template<typename Out>
+        static void AppendNumberText(Out &out, const char *text, size_t size, std::true_type)
+        {
+            out.AppendAscii(text, size);
+        }
+
+        template<typename Out, typename C>
+        static void AppendNumberText(Out &out, const C *text, size_t size, std::false_type)
+        {
+            out.Append(text, size);
+        }
+
+#if FORMAT_UTIL_VERIFY
+        // Mismatches found by the differential check of the direct conversions
+        struct MismatchLog
+        {
+            std::mutex mutex;
+            std::vector<std::string> cases;
+        };
+
+        static MismatchLog& Log()
+        {
+            static MismatchLog log;
+            return log;
+        }
+
+        // Records the case with the settings of the formatter: the value (exact), expected and actual output
+        template<typename V, typename T, typename C>
+        void RecordMismatch(const V &value, const T *expected, size_t expected_size, const C *actual, size_t actual_size) const
+        {
+            std::ostringstream description;
+            description.precision(std::numeric_limits<V>::max_digits10);
+            description << (std::is_floating_point<V>::value ? "float" : "integer") << " value " << +value
+                        << ", flags 0x" << std::hex << static_cast<unsigned long>(m_flags) << std::dec
+                        << ", precision " << m_precision << ", locale '" << m_ptr_locale->name()
+                        << "': stream '" << NarrowText(expected, expected_size)
+                        << "', direct '" << NarrowText(actual, actual_size) << "'";
+            MismatchLog &log = Log();
+            std::lock_guard<std::mutex> lock(log.mutex);
+            log.cases.push_back(description.str());
+#ifdef FORMAT_UTIL_VERIFY_CORPUS
+            std::ofstream corpus(FORMAT_UTIL_VERIFY_CORPUS, std::ios::app);
+            corpus << log.cases.back() << '\n';
+#endif
+        }
+
+        // Text for the description of mismatches: non-ASCII characters are replaced by '?'
+        template<typename C>
+        static std::string NarrowText(const C *text, size_t size)
+        {
+            std::string result;
+            for(size_t i = 0; i < size; ++i)
+            {
+                const bool ascii = text[i] >= static_cast<C>(0x20) && text[i] < static_cast<C>(0x7F);
+                result += ascii ? static_cast<char>(text[i]) : '?';
+            }
+            return result;
+        }
+#endif
+
+        // Outputs bool-values to the output: as 'true' or 'false'
+        template<typename Out>
+        void OutputValue(Out &out, bool b)
+        {
+            out.Append(b ? "true" : "false");
+        }
+
+        // Outputs unknown type to the output as a '?'-character
+        template<typename Out>
+        void OutputValue(Out &out, ...)
+        {
+            out.Append("?");
+        }
+
+        // Appends text field of a compiled template applying the UTF-8 policy to narrow text
+        template<typename Sink, typename T>
+        void AppendField(Sink &sink, const T *data, size_t size, std::false_type)
+        {
+            sink.Append(data, size);
+        }
+
+        template<typename Sink>
+        void AppendField(Sink &sink, const char *data, size_t size, std::true_type)
+        {
+            if(m_utf8==Utf8Mode::Replace)
+                OutputUtf8(sink, data, size);
+            else
+                sink.Append(data, size);
+        }
+
+        // Outputs characters of a string argument applying the UTF-8 policy to narrow text
+        template<typename Out, typename C>
+        void OutputText(Out &out, const C *str, size_t size)
+        {
+            OutputText(out, str, size, std::integral_constant<bool,
+                    std::is_same<C, char>::value && std::is_same<typename Out::CharType, char>::value>());
+        }
+
+        template<typename Out, typename C>
+        void OutputText(Out &out, const C *str, size_t size, std::true_type)
+        {
+            if(m_utf8==Utf8Mode::Replace)
+                OutputUtf8(out, str, size);
+            else
+                out.Append(str, size);
+        }
+
+        template<typename Out, typename C>
+        void OutputText(Out &out, const C *str, size_t size, std::false_type)
+        {
+            OutputChars(out, str, size);
+        }
+
+        // Copies UTF-8 text replacing each maximal invalid subsequence by U+FFFD
+        template<typename Out>
+        static void OutputUtf8(Out &out, const char *str, size_t size)
+        {
+            const unsigned char *text = reinterpret_cast<const unsigned char*>(str);
+            size_t pos = 0;
+            for(;;)
+            {
+                const size_t valid = ValidUtf8Prefix(text + pos, size - pos);
+                if(valid > 0)
+                    out.Append(str + pos, valid);
+                pos += valid;
+                if(pos==size)
+                    return;
+                size_t length;
+                Utf8Sequence(text + pos, size - pos, length);
+                out.Append("\xEF\xBF\xBD", 3);
+                pos += length;
+            }
+        }
+
+        // Returns length of the prefix of ASCII characters, runs of ASCII characters are checked by blocks
+        static size_t AsciiPrefix(const unsigned char *text, size_t size)
+        {
+            size_t pos = 0;
+#if FORMAT_UTIL_SSE2
+            for(; pos + 16 <= size; pos += 16)
+            {
+                const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos)));
+                if(mask!=0)
+                {
+    #if defined(__GNUC__)
+                    return pos + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+    #else
+                    break;
+    #endif
+                }
+            }
+#endif
+            for(; pos + 8 <= size; pos += 8)
+            {
+                uint64_t block;
+                std::memcpy(&block, text + pos, sizeof(block));
+                if(block & 0x8080808080808080ULL)
+                    break;
+            }
+            while(pos < size && text[pos] < 0x80)
+                ++pos;
+            return pos;
+        }
+
+        // Returns length of the valid UTF-8 prefix of the text
+        static size_t ValidUtf8Prefix(const unsigned char *text, size_t size)
+        {
+            size_t pos = 0;
+            while(pos < size)
+            {
+                pos += AsciiPrefix(text + pos, size - pos);
+                // Mixed text is checked by characters until the next run of ASCII characters
+                while(pos < size)
+                {
+                    if(text[pos] < 0x80)
+                    {
+                        if(pos + 16 <= size && text[pos + 1] < 0x80 && text[pos + 2] < 0x80 && text[pos + 3] < 0x80)
+                            break;
+                        ++pos;
+                        continue;
+                    }
+                    // Common two- and three-byte characters (except the ones with special ranges) are checked in place
+                    const unsigned char lead = text[pos];
+                    if(lead >= 0xC2 && lead <= 0xDF && pos + 1 < size && (text[pos + 1] & 0xC0)==0x80)
+                    {
+                        pos += 2;
+                        continue;
+                    }
+                    if(lead > 0xE0 && lead <= 0xEF && lead!=0xED && pos + 2 < size &&
+                       (text[pos + 1] & 0xC0)==0x80 && (text[pos + 2] & 0xC0)==0x80)
+                    {
+                        pos += 3;
+                        continue;
+                    }
+                    size_t length;
+                    if(!Utf8Sequence(text + pos, size - pos, length))
+                        return pos;
+                    pos += length;
+                }
+            }
+            return size;
+        }
+
+        // Checks UTF-8 sequence which starts with a non-ASCII byte.
+        // length - length of the valid sequence or of the maximal invalid subsequence (at least 1)
+        // Returns true if the sequence is valid
+        static bool Utf8Sequence(const unsigned char *text, size_t size, size_t &length)
+        {
+            const unsigned char lead = text[0];
+            unsigned char low = 0x80;
+            unsigned char high = 0xBF;
+            size_t need;
+            if(lead >= 0xC2 && lead <= 0xDF)
+                need = 2;
+            else if(lead >= 0xE0 && lead <= 0xEF)
+            {
+                need = 3;
+                if(lead==0xE0)
+                    low = 0xA0; // Overlong encoding
+                else if(lead==0xED)
+                    high = 0x9F; // Surrogates
+            }
+            else if(lead >= 0xF0 && lead <= 0xF4)
+            {
+                need = 4;
+                if(lead==0xF0)
+                    low = 0x90; // Overlong encoding
+                else if(lead==0xF4)
+                    high = 0x8F; // Code points above U+10FFFF
+            }
+            else
+            {
+                length = 1;
+                return lead < 0x80;
+            }
+            for(length = 1; length < need; ++length)
+            {
+                if(length==size || text[length] < low || text[length] > high)
+                    return false;
+                low = 0x80;
+                high = 0xBF;
+            }
+            return true;
+        }
+
+        // Outputs characters sequence of the given length
+        template<typename Out, typename C>
+        static void OutputChars(Out &out, const C *str, size_t size)
+        {
+            OutputChars(out, str, size, std::is_same<C, typename Out::CharType>());
+        }
+
+        // Characters of the same type as the output are copied directly
+        template<typename Out, typename C>
+        static void OutputChars(Out &out, const C *str, size_t size, std::true_type)
+        {
+            out.Append(str, size);
+        }
+
+        // Narrow characters are widened by the output stream (as for operator<<),
+        // characters of other types are unknown for the output
+        template<typename Out, typename C>
+        static void OutputChars(Out &out, const C *str, size_t size, std::false_type)
+        {
+            if(!std::is_same<C, char>::value)
+            {
+                out.Append("?");
+                return;
+            }
+            for(size_t i = 0; i < size; ++i)
+                out.Stream() << static_cast<char>(str[i]);
+        }
+};
+
+///\brief Formatter with constant context prefix.
+///\details Each output string starts with the same context: timestamp, constant part
+/// (host, service, pid etc.) and thread id. The context is rendered in advance
+/// and cached for each thread: the timestamp is refreshed once per second, the thread id
+/// is rendered once per thread. Formatting copies the cached prefix ahead of the normal substitution.
+/// The prefix layout is: '<timestamp> <context><thread id> '. Wide outputs get the prefix widened
+/// by the locale of the formatter, as narrow strings are widened for operator<<.
+/// All output methods (Format, FormatRange, FormatTo, FormatRangeTo for sequences, ranges and compiled
+/// templates) prepend the prefix; the formatter is not convertible to Formatter, so the output
+/// without the prefix does not compile.
+/// The settings (SetContext, EnableTimestamp, EnableThreadId) are not synchronized with the output:
+/// they must be set up before the formatter is used from several threads. After that the formatter
+/// is only read, and each thread keeps its own copy of the prefix.
+/// Example:
+///    ContextFormatter formatter;
+///    formatter.SetContext("%? %?[%?] ", host, service, pid);
+///    formatter.EnableTimestamp(true);
+///    std::string line = formatter.Format("Request: %?", id); // "2026-10-18T09:30:00Z web-1 api[42] Request: 7"
+///
+class ContextFormatter : private Formatter
+{
+    public:
+        using Formatter::Compile;
+        using Formatter::CompileRange;
+        using Formatter::CompileStyled;
+        using Formatter::CompileStyledRange;
+        using Formatter::Flags;
+        using Formatter::SetF;
+        using Formatter::UnSetF;
+        using Formatter::Getloc;
+        using Formatter::Precision;
+        using Formatter::Utf8;
+
+        ContextFormatter()
+           : m_id(NextId()),
+             m_version(0),
+             m_timestamp(false),
+             m_thread_id(false)
+        { }
+
+        ContextFormatter(const std::locale& loc,
+                         std::ios_base::fmtflags flags = std::ios_base::skipws | std::ios_base::dec,
+                         std::streamsize precision = 6)
+           : Formatter(loc, flags, precision),
+             m_id(NextId()),
+             m_version(0),
+             m_timestamp(false),
+             m_thread_id(false)
+        { }
+
+        ///\brief Sets locale for formatting, the prefix of wide outputs is widened by it.
+        /// Not thread-safe: must not be called while other threads use the formatter.
+        ///\param loc - new locale for the formatter
+        ///\return the previous locale
+        std::locale Imbue(const std::locale& loc)
+        {
+            ++m_version;
+            return Formatter::Imbue(loc);
+        }
+
+        ///\brief Sets constant part of the context, it is rendered once.
+        /// Not thread-safe: must not be called while other threads use the formatter.
+        ///\param seq - context format sequence
+        ///\param args - list of arguments
+        template<typename... Args>
+        void SetContext(const char* seq, const Args&... args)
+        {
+            m_context.clear();
+            Formatter::FormatTo(m_context, seq, args...);
+            ++m_version;
+        }
+
+        /// Enables or disables UTC timestamp ('2026-10-18T09:30:00Z ') at the beginning of the context.
+        /// Not thread-safe: must not be called while other threads use the formatter.
+        ///\param enable - true to output timestamp
+        void EnableTimestamp(bool enable)
+        {
+            m_timestamp = enable;
+            ++m_version;
+        }
+
+        /// Enables or disables thread id at the end of the context.
+        /// Not thread-safe: must not be called while other threads use the formatter.
+        ///\param enable - true to output thread id
+        void EnableThreadId(bool enable)
+        {
+            m_thread_id = enable;
+            ++m_version;
+        }
+
+        ///\brief Generates string from the context and char sequence filled with parameters.
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> Format(const T* seq, const Args&... args)
+        {
+            return FormatRange(seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Generates string from the context and contiguous range of characters filled with parameters.
+        ///\param range - initial characters range (string, string_view, vector etc.)
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        std::basic_string<T> Format(const Range &range, const Args&... args)
+        {
+            return FormatRange(range.data(), range.size(), args...);
+        }
+
+        ///\brief Generates string from the context and compiled template filled with parameters.
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> Format(const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatTo(result, tmpl, args...);
+            return result;
+        }
+
+        ///\brief Generates string from the context and characters sequence of the given length filled with parameters.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> FormatRange(const T* seq, size_t size, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatRangeTo(result, seq, size, args...);
+            return result;
+        }
+
+        ///\brief Appends the context and char sequence filled with parameters to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const T* seq, const Args&... args)
+        {
+            FormatRangeTo(target, seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Appends the context and contiguous range of characters filled with parameters to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param range - initial characters range (string, string_view, vector etc.)
+        ///\param args - list of arguments
+        template<typename Target, typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        void FormatTo(Target &target, const Range &range, const Args&... args)
+        {
+            FormatRangeTo(target, range.data(), range.size(), args...);
+        }
+
+        ///\brief Appends the context and compiled template filled with parameters to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            FormatPrefixedTemplateWith<DefaultFormatPolicy>(target, Prefix(T()), tmpl, args...);
+        }
+
+        ///\brief Appends the context and characters sequence of the given length filled with parameters.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatRangeTo(Target &target, const T* seq, size_t size, const Args&... args)
+        {
+            FormatPrefixedRangeWith<DefaultFormatPolicy>(target, Prefix(T()), seq, size, args...);
+        }
+
+    private:
+        // Context prefix of a formatter cached for the thread
+        struct PrefixCache
+        {
+            uint64_t owner = 0;
+            uint64_t version = 0;
+            int64_t second = 0;
+            // Last use of the slot, the least recently used slot is replaced
+            uint64_t used = 0;
+            std::string prefix;
+            // Prefix for wide outputs, it is valid until the prefix is changed
+            bool wide_valid = false;
+            std::wstring wide_prefix;
+        };
+
+        // Number of formatters which have their prefixes cached in each thread
+        static const size_t PREFIX_CACHE_SLOTS = 8;
+
+        // Unique id of the formatter, distinguishes formatters in thread caches
+        const uint64_t m_id;
+        // Version of context settings, is changed on each change of settings
+        uint64_t m_version;
+        bool m_timestamp;
+        bool m_thread_id;
+        // Constant part of the context
+        std::string m_context;
+
+        static uint64_t NextId()
+        {
+            static std::atomic<uint64_t> counter(0);
+            return ++counter;
+        }
+
+        // Returns the context prefix for the current thread and second
+        const std::string& Prefix(char)
+        {
+            return UpdatedSlot().prefix;
+        }
+
+        // Returns the context prefix widened for wide outputs, it is widened once per change of the prefix
+        const std::wstring& Prefix(wchar_t)
+        {
+            PrefixCache &cache = UpdatedSlot();
+            if(!cache.wide_valid)
+            {
+                cache.wide_prefix.resize(cache.prefix.size());
+                std::use_facet<std::ctype<wchar_t>>(Getloc()).widen(cache.prefix.data(),
+                        cache.prefix.data() + cache.prefix.size(), &cache.wide_prefix[0]);
+                cache.wide_valid = true;
+            }
+            return cache.wide_prefix;
+        }
+
+        // Returns the cache slot of the formatter with the prefix for the current thread and second
+        PrefixCache& UpdatedSlot()
+        {
+            PrefixCache &cache = CacheSlot();
+            if(cache.owner==m_id && cache.version==m_version)
+            {
+                if(m_timestamp)
+                {
+                    const int64_t second = CurrentSecond();
+                    if(cache.second!=second) // The timestamp is always at the beginning of the prefix
+                    {
+                        WriteTimestamp(second, &cache.prefix[0]);
+                        cache.second = second;
+                        cache.wide_valid = false;
+                    }
+                }
+                return cache;
+            }
+            const int64_t second = m_timestamp ? CurrentSecond() : 0;
+            cache.owner = m_id;
+            cache.version = m_version;
+            cache.second = second;
+            cache.wide_valid = false;
+            cache.prefix.clear();
+            if(m_timestamp)
+            {
+                cache.prefix.resize(TIMESTAMP_SIZE);
+                WriteTimestamp(second, &cache.prefix[0]);
+                cache.prefix += ' ';
+            }
+            cache.prefix += m_context;
+            if(m_thread_id)
+            {
+                Formatter::FormatTo(cache.prefix, "%? ", ThreadIdText());
+            }
+            return cache;
+        }
+
+        // Returns the cache slot of the formatter in the current thread
+        // or the least recently used slot, which is to be filled for the formatter
+        PrefixCache& CacheSlot() const
+        {
+            static thread_local PrefixCache slots[PREFIX_CACHE_SLOTS];
+            static thread_local uint64_t clock = 0;
+            PrefixCache *slot = &slots[0];
+            for(PrefixCache &candidate : slots)
+            {
+                if(candidate.owner==m_id)
+                {
+                    slot = &candidate;
+                    break;
+                }
+                if(candidate.used < slot->used)
+                    slot = &candidate;
+            }
+            slot->used = ++clock;
+            return *slot;
+        }
+
+        static int64_t CurrentSecond()
+        {
+            return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+
+        // Returns id of the current thread rendered once for the thread
+        static const std::string& ThreadIdText()
+        {
+            static thread_local std::string text;
+            if(text.empty())
+            {
+                std::ostringstream stream;
+                stream << std::this_thread::get_id();
+                text = stream.str();
+            }
+            return text;
+        }
+
+        // Length of the timestamp: 'YYYY-MM-DDTHH:MM:SSZ'
+        static const size_t TIMESTAMP_SIZE = 20;
+
+        // Writes UTC time in ISO 8601 format: 'YYYY-MM-DDTHH:MM:SSZ'
+        // The civil date is computed from the days since epoch, without the C time functions
+        static void WriteTimestamp(int64_t seconds, char *pos)
+        {
+            int64_t days = seconds / 86400;
+            int64_t day_seconds = seconds % 86400;
+            if(day_seconds < 0)
+            {
+                day_seconds += 86400;
+                --days;
+            }
+            days += 719468;
+            const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+            const int64_t day_of_era = days - era * 146097;
+            const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+            const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+            const int64_t mp = (5 * day_of_year + 2) / 153;
+            const int64_t day = day_of_year - (153 * mp + 2) / 5 + 1;
+            const int64_t month = mp < 10 ? mp + 3 : mp - 9;
+            const int64_t year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+            WriteFixed(year, 4, pos);
+            pos[4] = '-';
+            WriteFixed(month, 2, pos + 5);
+            pos[7] = '-';
+            WriteFixed(day, 2, pos + 8);
+            pos[10] = 'T';
+            WriteFixed(day_seconds / 3600, 2, pos + 11);
+            pos[13] = ':';
+            WriteFixed(day_seconds / 60 % 60, 2, pos + 14);
+            pos[16] = ':';
+            WriteFixed(day_seconds % 60, 2, pos + 17);
+            pos[19] = 'Z';
+        }
+
+        // Writes the number with leading zeros
+        static void WriteFixed(int64_t value, int width, char *pos)
+        {
+            for(int i = width - 1; i >= 0; --i)
+            {
+                pos[i] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+        }
+};
+
+///\brief Formatter with compile-time conversions of argument types.
+///\details The policy maps argument types to their output: its static 'Convert' overloads
+/// are selected for each argument and for each element of containers, pairs, tuples, smart pointers etc.
+/// at compile time, so each type gets its own straight-line output code without checks of runtime flags.
+/// Types without own conversion are output in the same way as by Formatter (see DefaultFormatPolicy).
+/// Example:
+///    struct LogPolicy : DefaultFormatPolicy
+///    {
+///        using DefaultFormatPolicy::Convert;
+///        static Formatter::FSignificant Convert(double v) { return Formatter::Significant(v, 3); }
+///        static Formatter::FHex Convert(uint64_t id) { return Formatter::Hex(id); }
+///        static Formatter::FHex Convert(const void *ptr) { return Formatter::Pointer(ptr); }
+///    };
+///    PolicyFormatter<LogPolicy> formatter;
+///    formatter.Format("%? %? %?", 3.14159, uint64_t(255), 10); // "3.14 ff 10"
+///
+template<typename Policy>
+class PolicyFormatter : public Formatter
+{
+    public:
+        PolicyFormatter()
+        { }
+
+        PolicyFormatter(const std::locale& loc,
+                        std::ios_base::fmtflags flags = std::ios_base::skipws | std::ios_base::dec,
+                        std::streamsize precision = 6)
+           : Formatter(loc, flags, precision)
+        { }
+
+        ///\brief Generates string from char sequence filled with parameters converted by the policy.
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> Format(const T* seq, const Args&... args)
+        {
+            return FormatRange(seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Generates string from contiguous range of characters filled with parameters converted by the policy.
+        ///\param range - initial characters range (string, string_view, vector etc.)
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        std::basic_string<T> Format(const Range &range, const Args&... args)
+        {
+            return FormatRange(range.data(), range.size(), args...);
+        }
+
+        ///\brief Generates string from compiled template filled with parameters converted by the policy.
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> Format(const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatTo(result, tmpl, args...);
+            return result;
+        }
+
+        ///\brief Generates string from characters sequence of the given length filled with parameters converted by the policy.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return built string
+        template<typename T, typename... Args>
+        std::basic_string<T> FormatRange(const T* seq, size_t size, const Args&... args)
+        {
+            std::basic_string<T> result;
+            FormatRangeTo(result, seq, size, args...);
+            return result;
+        }
+
+        ///\brief Appends char sequence filled with parameters converted by the policy to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to sequence (for example, char*)
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const T* seq, const Args&... args)
+        {
+            FormatRangeTo(target, seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Appends contiguous range of characters filled with parameters converted by the policy to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param range - initial characters range (string, string_view, vector etc.)
+        ///\param args - list of arguments
+        template<typename Target, typename Range, typename... Args,
+                typename T = typename CharRange<Range>::CharType>
+        void FormatTo(Target &target, const Range &range, const Args&... args)
+        {
+            FormatRangeTo(target, range.data(), range.size(), args...);
+        }
+
+        ///\brief Appends compiled template filled with parameters converted by the policy to the output target.
+        ///\param target - string, vector or sink to append the output to
+        ///\param tmpl - compiled template (see 'Compile')
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatTo(Target &target, const BasicFormatTemplate<T> &tmpl, const Args&... args)
+        {
+            FormatTemplateWith<Policy>(target, tmpl, args...);
+        }
+
+        ///\brief Appends characters sequence of the given length filled with parameters converted by the policy.
+        ///\param target - string, vector or sink to append the output to
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        template<typename Target, typename T, typename... Args>
+        void FormatRangeTo(Target &target, const T* seq, size_t size, const Args&... args)
+        {
+            FormatRangeWith<Policy>(target, seq, size, args...);
+        }
+};
+
+///\brief Retention policy for a reused output buffer.
+///\details A buffer which is cleared and reused keeps its memory, so it does not grow again for each output.
+/// The policy limits what is kept after outliers: the buffer keeps at most the high-water mark
+/// of recent outputs, which decays with each reuse, and never more than 'max_capacity'.
+/// A buffer which holds more than twice of this is reallocated on reuse; 'Trim' releases the memory at once.
+/// Memory kept by idle buffers of all policies is counted (see 'TotalRetained', 'PeakRetained' and 'Trims').
+/// Example:
+///    BufferRetention retention(1024 * 1024);
+///    for(;;)
+///    {
+///        formatter.FormatTo(buffer, "%?", message); // an outlier message may grow the buffer a lot
+///        Send(buffer);
+///        retention.Recycle(buffer); // clears the buffer, a large outlier buffer is shrunk soon
+///    }
+///
+class BufferRetention
+{
+    public:
+        // Default maximum of memory kept by a buffer
+        static const size_t DEFAULT_MAX_CAPACITY = 1024 * 1024;
+
+        ///\param max_capacity - maximum capacity (in elements) kept by the buffer between outputs
+        ///\param decay_shift - the high-water mark decays by 1/(2^decay_shift) with each reuse
+        explicit BufferRetention(size_t max_capacity = DEFAULT_MAX_CAPACITY, unsigned decay_shift = 2)
+           : m_max_capacity(max_capacity),
+             m_decay_shift(decay_shift < 63 ? decay_shift : 63),
+             m_high_water_mark(0),
+             m_retained(0)
+        { }
+
+        ~BufferRetention()
+        {
+            Account(0);
+        }
+
+        // The copy has the same policy and high-water mark, it does not keep memory yet
+        BufferRetention(const BufferRetention &other)
+           : m_max_capacity(other.m_max_capacity),
+             m_decay_shift(other.m_decay_shift),
+             m_high_water_mark(other.m_high_water_mark),
+             m_retained(0)
+        { }
+
+        BufferRetention& operator=(const BufferRetention&) = delete;
+
+        ///\brief Clears the buffer for reuse and applies the policy to its memory.
+        ///\param buffer - string or vector
+        template<typename Buffer>
+        void Recycle(Buffer &buffer)
+        {
+            Learn(buffer.size());
+            buffer.clear();
+            if(buffer.capacity() > 2 * Hint())
+            {
+                Buffer kept;
+                kept.reserve(Hint());
+                buffer.swap(kept);
+                Counter(TRIMS).fetch_add(1, std::memory_order_relaxed);
+            }
+            Account(buffer.capacity() * sizeof(typename Buffer::value_type));
+        }
+
+        ///\brief Records the size of the output which is moved out of the buffer (the buffer is empty after that).
+        ///\param size - size of the output
+        void Released(size_t size)
+        {
+            Learn(size);
+            Account(0);
+        }
+
+        ///\brief Releases all memory of the buffer and forgets the high-water mark.
+        ///\param buffer - string or vector
+        template<typename Buffer>
+        void Trim(Buffer &buffer)
+        {
+            Buffer().swap(buffer);
+            m_high_water_mark = 0;
+            Counter(TRIMS).fetch_add(1, std::memory_order_relaxed);
+            Account(0);
+        }
+
+        /// Returns the capacity to reserve for the next output: the decayed high-water mark
+        /// limited by the maximum capacity
+        size_t Hint() const
+        {
+            return m_high_water_mark < m_max_capacity ? m_high_water_mark : m_max_capacity;
+        }
+
+        /// Returns the high-water mark of recent output sizes
+        size_t HighWaterMark() const
+        {
+            return m_high_water_mark;
+        }
+
+        /// Returns the memory (in bytes) kept by the buffer while it is idle
+        size_t Retained() const
+        {
+            return m_retained;
+        }
+
+        /// Returns the memory (in bytes) kept by all idle buffers with a retention policy
+        static size_t TotalRetained()
+        {
+            return static_cast<size_t>(Counter(RETAINED).load(std::memory_order_relaxed));
+        }
+
+        /// Returns the maximum of 'TotalRetained' since the start of the program
+        static size_t PeakRetained()
+        {
+            return static_cast<size_t>(Counter(PEAK).load(std::memory_order_relaxed));
+        }
+
+        /// Returns the number of reallocations and releases of buffers due to the policy
+        static uint64_t Trims()
+        {
+            return Counter(TRIMS).load(std::memory_order_relaxed);
+        }
+
+    private:
+        enum CounterId { RETAINED, PEAK, TRIMS };
+
+        const size_t m_max_capacity;
+        const unsigned m_decay_shift;
+        size_t m_high_water_mark;
+        // Capacity of the buffer which is counted in 'TotalRetained'
+        size_t m_retained;
+
+        void Learn(size_t size)
+        {
+            const size_t decayed = m_high_water_mark - (m_high_water_mark >> m_decay_shift);
+            m_high_water_mark = size > decayed ? size : decayed;
+        }
+
+        // Updates the counted memory of the buffer
+        void Account(size_t capacity)
+        {
+            if(capacity==m_retained)
+                return;
+            uint64_t total;
+            if(capacity > m_retained)
+                total = Counter(RETAINED).fetch_add(capacity - m_retained, std::memory_order_relaxed) + (capacity - m_retained);
+            else
+                total = Counter(RETAINED).fetch_sub(m_retained - capacity, std::memory_order_relaxed) - (m_retained - capacity);
+            m_retained = capacity;
+            std::atomic<uint64_t> &peak = Counter(PEAK);
+            uint64_t current = peak.load(std::memory_order_relaxed);
+            while(total > current && !peak.compare_exchange_weak(current, total, std::memory_order_relaxed))
+            { }
+        }
+
+        static std::atomic<uint64_t>& Counter(CounterId id)
+        {
+            static std::atomic<uint64_t> counters[3] = {{0}, {0}, {0}};
+            return counters[id];
+        }
+};
+
+///\brief Builder of multi-message output.
+///\details Appends sequences filled with parameters into one growing buffer,
+/// for example, lines of a report. The buffer can be accessed without copying.
+/// Sizes of previous builds are remembered: when the buffer is released, the next build
+/// reserves the memory for the expected size at once. The memory kept between builds
+/// is limited by a retention policy (see BufferRetention), so an outlier build is not kept forever.
+/// The formatter type is a template parameter: the messages are output by its own FormatRangeTo,
+/// so a PolicyFormatter keeps its conversions and a ContextFormatter prepends its context to each message.
+/// Example:
+///    Formatter formatter;
+///    FormatBuilder builder(formatter);
+///    for(const Item &item : items)
+///        builder.Append("%?: %?\n", item.name, item.value);
+///    std::cout << builder.Str();
+///    builder.Reset(); // the buffer memory is kept for the next report
+///
+///    ContextFormatter context;
+///    BasicFormatBuilder<char, ContextFormatter> lines(context); // each line starts with the context
+///
+template<typename T, typename F = Formatter>
+class BasicFormatBuilder
+{
+    public:
+        ///\param formatter - formatter used for the output (its settings are used)
+        ///\param max_retained - maximum memory kept by the buffer between builds
+        explicit BasicFormatBuilder(F &formatter, size_t max_retained = BufferRetention::DEFAULT_MAX_CAPACITY)
+           : m_formatter(formatter),
+             m_retention(max_retained / sizeof(T))
+        { }
+
+        ///\brief Appends char sequence filled with parameters to the buffer.
+        ///\param seq - pointer to sequence
+        ///\param args - list of arguments
+        ///\return The builder itself
+        template<typename... Args>
+        BasicFormatBuilder& Append(const T *seq, const Args&... args)
+        {
+            return AppendRange(seq, std::char_traits<T>::length(seq), args...);
+        }
+
+        ///\brief Appends contiguous range of characters (string, string_view etc.) filled with parameters to the buffer.
+        ///\param range - characters range
+        ///\param args - list of arguments
+        ///\return The builder itself
+        template<typename Range, typename... Args,
+                typename = decltype(std::declval<const Range&>().data() + std::declval<const Range&>().size())>
+        BasicFormatBuilder& Append(const Range &range, const Args&... args)
+        {
+            return AppendRange(range.data(), range.size(), args...);
+        }
+
+        ///\brief Appends characters sequence of the given length filled with parameters to the buffer.
+        ///\param seq - pointer to the first character of the sequence
+        ///\param size - length of the sequence
+        ///\param args - list of arguments
+        ///\return The builder itself
+        template<typename... Args>
+        BasicFormatBuilder& AppendRange(const T *seq, size_t size, const Args&... args)
+        {
+            if(m_buffer.empty() && m_buffer.capacity() < m_retention.Hint())
+                m_buffer.reserve(m_retention.Hint());
+            m_formatter.FormatRangeTo(m_buffer, seq, size, args...);
+            return *this;
+        }
+
+        /// Returns the built output without copying
+        ///\return The buffer
+        const std::basic_string<T>& Str() const
+        {
+            return m_buffer;
+        }
+
+        /// Returns size of the built output
+        size_t Size() const
+        {
+            return m_buffer.size();
+        }
+
+        /// Moves the built output out of the builder and starts a new build
+        ///\return The built output
+        std::basic_string<T> Release()
+        {
+            m_retention.Released(m_buffer.size());
+            std::basic_string<T> result;
+            result.swap(m_buffer);
+            return result;
+        }
+
+        /// Clears the built output keeping the buffer memory for the next build (within the retention limit)
+        void Reset()
+        {
+            m_retention.Recycle(m_buffer);
+        }
+
+        /// Clears the built output and releases the buffer memory
+        void Trim()
+        {
+            m_retention.Trim(m_buffer);
+        }
+
+        /// Returns the retention policy of the buffer (memory counters)
+        const BufferRetention& Retention() const
+        {
+            return m_retention;
+        }
+
+    private:
+        F &m_formatter;
+        std::basic_string<T> m_buffer;
+        // Expected size of a build (the maximum of recent builds, decays slowly) and the memory limit
+        BufferRetention m_retention;
+};
+
+typedef BasicFormatBuilder<char> FormatBuilder;
+typedef BasicFormatBuilder<wchar_t> WFormatBuilder;
+
+///\brief Format sequence compiled for repeated output (see Formatter::Compile).
+///\details Literal parts of the sequence are stored one after another (screened '%%?'-values
+/// are already turned into '%?'), together with the positions of the format specifiers between them.
+/// The template does not depend on the formatter settings, it can be shared by several formatters and threads.
+/// Example:
+///    Formatter formatter;
+///    FormatTemplate tmpl = formatter.Compile("INSERT INTO t VALUES (%?, '%?');\n");
+///    for(const Row &row : rows)
+///        formatter.FormatTo(output, tmpl, row.id, row.name);
+///
+template<typename T>
+class BasicFormatTemplate
+{
+    public:
+        // Text field for Formatter::FormatFieldsTo
+        struct Field
+        {
+            const T *data;
+            size_t size;
+        };
+
+        BasicFormatTemplate()
+           : m_ends(1, 0)
+        { }
+
+        /// Returns number of format specifiers in the template
+        size_t Specifiers() const
+        {
+            return m_ends.size() - 1;
+        }
+
+        /// Returns the literal part which precedes the format specifier with the given index
+        /// (the part with index 'Specifiers()' follows the last specifier)
+        ///\param index - index of the part
+        ///\param size - size of the part
+        ///\return Pointer to the first character of the part
+        const T* Part(size_t index, size_t &size) const
+        {
+            const size_t begin = index==0 ? 0 : m_ends[index - 1];
+            size = m_ends[index] - begin;
+            return m_text.data() + begin;
+        }
+
+        /// Returns the source sequence of the template
+        const std::basic_string<T>& Source() const
+        {
+            return m_source;
+        }
+
+    private:
+        friend class Formatter;
+
+        // Source sequence (it is output as is when there are no arguments)
+        std::basic_string<T> m_source;
+        // Literal parts of the sequence
+        std::basic_string<T> m_text;
+        // End of each literal part in 'm_text', a format specifier follows each part except the last one
+        std::vector<size_t> m_ends;
+};
+
+typedef BasicFormatTemplate<char> FormatTemplate;
+typedef BasicFormatTemplate<wchar_t> WFormatTemplate;
+
+///\brief Coloured and plain variants of a template with style markup (see Formatter::CompileStyled).
+///\details The variant is selected once, for example, when the output is a terminal:
+///    StyledTemplate tmpl = formatter.CompileStyled("{bold}%?{/}: %<red>?\n");
+///    const FormatTemplate &line = tmpl.Select(StyledTemplate::IsTerminal(STDOUT_FILENO));
+///    formatter.FormatTo(output, line, name, error);
+///
+template<typename T>
+class BasicStyledTemplate
+{
+    public:
+        /// Returns the template with ANSI escape sequences
+        const BasicFormatTemplate<T>& Colored() const
+        {
+            return m_colored;
+        }
+
+        /// Returns the template without styles
+        const BasicFormatTemplate<T>& Plain() const
+        {
+            return m_plain;
+        }
+
+        ///\param colored - true for the coloured variant
+        ///\return The selected variant
+        const BasicFormatTemplate<T>& Select(bool colored) const
+        {
+            return colored ? m_colored : m_plain;
+        }
+
+        /// Returns true if the file descriptor is a terminal and colours are not disabled
+        /// by the NO_COLOR environment variable
+        static bool IsTerminal(int fd)
+        {
+            const char *no_color = std::getenv("NO_COLOR");
+            if(no_color && *no_color)
+                return false;
+#ifdef _WIN32
+            return _isatty(fd)!=0;
+#else
+            return isatty(fd)!=0;
+#endif
+        }
+
+    private:
+        friend class Formatter;
+
+        BasicFormatTemplate<T> m_colored;
+        BasicFormatTemplate<T> m_plain;
+};
+
+typedef BasicStyledTemplate<char> StyledTemplate;
+typedef BasicStyledTemplate<wchar_t> WStyledTemplate;
+
+// Helper function for output proxy-object (FWrapper) via operator<<.
+// See method 'Output' of Formatter-class
+template<typename C, typename T>
+std::basic_ostream<C>& operator<<(std::basic_ostream<C>& os, const Formatter::FWrapper<T> &fw)
+{
+    os << fw.t;
+    return os;
 }
 
+/// Registers names of enumeration values for the output by Formatter.
+/// Must be used in the global namespace. All values to be output by name are listed.
+/// Example:
+///     enum class Color { Red, Green, Blue };
+///     FORMAT_UTIL_ENUM(Color, Color::Red, Color::Green, Color::Blue)
+///     ...
+///     formatter.Format("Color: %?", Color::Green); // "Color: Green"
+#define FORMAT_UTIL_ENUM(Enum, ...)                                                     \
+    template<>                                                                          \
+    struct FormatterEnum<Enum>                                                          \
+    {                                                                                   \
+        typedef Formatter::EnumTable<std::underlying_type<Enum>::type> TableType;       \
+        static const TableType& Table()                                                 \
+        {                                                                               \
+            static const Enum values[] = { __VA_ARGS__ };                               \
+            static const TableType table(values,                                        \
+                    sizeof(values) / sizeof(values[0]), #__VA_ARGS__);                  \
+            return table;                                                               \
+        }                                                                               \
+    };
+
 #endif // FORMAT_UTIL_H_INCLUDED
@@ -0,0 +1,383 @@
+#ifndef FORMAT_UTIL_COMPRESS_H_INCLUDED
+#define FORMAT_UTIL_COMPRESS_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include "format_util.h"
+
+// Codec of the compressed output:
+//   FORMAT_UTIL_COMPRESS_ZSTD - zstd frames (requires zstd library: -lzstd);
+//   FORMAT_UTIL_COMPRESS_LZ4 - LZ4 frame with blocks compressed by LZ4 library (-llz4);
+//   otherwise - LZ4 frame with blocks compressed by the built-in compressor (no dependencies).
+// In all cases the output is a standard file: it can be read by 'zstd -d' or 'lz4 -d'.
+#if defined(FORMAT_UTIL_COMPRESS_ZSTD)
+    #include <zstd.h>
+#elif defined(FORMAT_UTIL_COMPRESS_LZ4)
+    #include <lz4.h>
+#endif
+
+///\brief Sink which compresses the output in blocks on a background thread and writes it to a file descriptor.
+///\details The output is collected into blocks. Full blocks are passed to the background thread,
+/// which compresses and writes them, while the formatting continues into the next block.
+/// The number of blocks in flight is limited: if the background thread falls behind,
+/// the output waits for a free block.
+/// The rest of the output is compressed and written on 'Close' or on destruction.
+/// The output after 'Close' is dropped and makes 'Good' return false.
+/// Errors are not thrown: 'Good' returns false after the first failure.
+/// Example:
+///    int fd = open("log.txt.lz4", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+///    CompressSink sink(fd);
+///    formatter.FormatTo(sink, "%? %?\n", time, message);
+///    ...
+///    sink.Close();
+///
+class CompressSink
+{
+    public:
+        ///\param fd - file descriptor for the compressed output (it is not closed by the sink)
+        ///\param block_size - size of uncompressed blocks (up to 4 MiB)
+        ///\param blocks_in_flight - maximum number of blocks waiting for the compression
+        explicit CompressSink(int fd, size_t block_size = 1024 * 1024, size_t blocks_in_flight = 4)
+           : m_fd(fd),
+             m_block_size(block_size==0 ? 1 : (block_size > MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : block_size)),
+             m_free_blocks(blocks_in_flight==0 ? 1 : blocks_in_flight),
+             m_stop(false),
+             m_closed(false),
+             m_good(true)
+        {
+            m_block.reserve(m_block_size);
+            m_worker = std::thread(&CompressSink::Work, this);
+        }
+
+        ~CompressSink()
+        {
+            Close();
+        }
+
+        CompressSink(const CompressSink&) = delete;
+        CompressSink& operator=(const CompressSink&) = delete;
+
+        void Append(const char *data, size_t size)
+        {
+            if(m_closed)
+            {
+                Fail();
+                return;
+            }
+            while(size > 0)
+            {
+                const size_t room = m_block_size - m_block.size();
+                const size_t part = size < room ? size : room;
+                m_block.insert(m_block.end(), data, data + part);
+                data += part;
+                size -= part;
+                if(m_block.size()==m_block_size)
+                    Submit();
+            }
+        }
+
+        /// Passes the collected output to the compression (the block is compressed even if it is not full)
+        void Flush()
+        {
+            if(!m_closed && !m_block.empty())
+                Submit();
+        }
+
+        /// Compresses and writes the rest of the output, finishes the compressed stream
+        ///\return true if there were no errors
+        bool Close()
+        {
+            if(m_closed)
+                return m_good;
+            Flush();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_has_work.notify_one();
+            m_worker.join();
+            m_closed = true;
+            return m_good;
+        }
+
+        bool Good() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_good;
+        }
+
+    private:
+        static const size_t MAX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+        int m_fd;
+        const size_t m_block_size;
+        // Block which is filled by the output
+        std::vector<char> m_block;
+        // Blocks waiting for the compression, and spare blocks for reuse
+        std::deque<std::vector<char>> m_queue;
+        std::vector<std::vector<char>> m_spare;
+        size_t m_free_blocks;
+        bool m_stop;
+        bool m_closed;
+        bool m_good;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_has_work;
+        std::condition_variable m_has_free_block;
+        std::thread m_worker;
+
+        // Output after 'Close' has no background thread to take it
+        void Fail()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_good = false;
+        }
+
+        // Passes the current block to the background thread and takes a free block
+        void Submit()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_has_free_block.wait(lock, [this] { return m_free_blocks > 0; });
+            --m_free_blocks;
+            m_queue.push_back(std::vector<char>());
+            m_queue.back().swap(m_block);
+            if(!m_spare.empty())
+            {
+                m_block.swap(m_spare.back());
+                m_spare.pop_back();
+            }
+            lock.unlock();
+            m_has_work.notify_one();
+            m_block.clear();
+            m_block.reserve(m_block_size);
+        }
+
+        // Background thread: compresses and writes blocks
+        void Work()
+        {
+            std::vector<unsigned char> compressed;
+            bool good = WriteHeader(compressed);
+            for(;;)
+            {
+                std::vector<char> block;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_has_work.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                    if(m_queue.empty())
+                        break;
+                    block.swap(m_queue.front());
+                    m_queue.pop_front();
+                }
+                if(good)
+                    good = WriteBlock(reinterpret_cast<const unsigned char*>(block.data()), block.size(), compressed);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    block.clear();
+                    m_spare.push_back(std::vector<char>());
+                    m_spare.back().swap(block);
+                    ++m_free_blocks;
+                    if(!good)
+                        m_good = false;
+                }
+                m_has_free_block.notify_one();
+            }
+            if(good)
+                good = WriteEnd(compressed);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!good)
+                m_good = false;
+        }
+
+        bool Write(const unsigned char *data, size_t size)
+        {
+            while(size > 0)
+            {
+                const ssize_t written = write(m_fd, data, size);
+                if(written < 0)
+                {
+                    if(errno==EINTR)
+                        continue;
+                    return false;
+                }
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+
+#if defined(FORMAT_UTIL_COMPRESS_ZSTD)
+        // zstd: each block is an independent frame, concatenated frames form a valid zstd stream
+
+        bool WriteHeader(std::vector<unsigned char>&)
+        {
+            return true;
+        }
+
+        bool WriteBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &compressed)
+        {
+            compressed.resize(ZSTD_compressBound(size));
+            const size_t result = ZSTD_compress(&compressed[0], compressed.size(), data, size, 1);
+            if(ZSTD_isError(result))
+                return false;
+            return Write(&compressed[0], result);
+        }
+
+        bool WriteEnd(std::vector<unsigned char>&)
+        {
+            return true;
+        }
+#else
+        // LZ4 frame: header, blocks (each block is independent), end mark
+
+        bool WriteHeader(std::vector<unsigned char>&)
+        {
+            // Magic number, FLG: version 01, independent blocks; BD: maximum block size 4 MiB
+            unsigned char header[7] = {0x04, 0x22, 0x4D, 0x18, 0x60, 0x70, 0};
+            header[6] = static_cast<unsigned char>((HeaderHash(header + 4, 2) >> 8) & 0xFF);
+            return Write(header, sizeof(header));
+        }
+
+        bool WriteBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &compressed)
+        {
+            compressed.resize(4 + size + size / 255 + 16);
+#if defined(FORMAT_UTIL_COMPRESS_LZ4)
+            const int result = LZ4_compress_default(reinterpret_cast<const char*>(data),
+                    reinterpret_cast<char*>(&compressed[4]), static_cast<int>(size), static_cast<int>(compressed.size() - 4));
+            size_t compressed_size = result > 0 ? static_cast<size_t>(result) : size;
+#else
+            size_t compressed_size = CompressLz4Block(data, size, &compressed[4]);
+#endif
+            uint32_t block_header = static_cast<uint32_t>(compressed_size);
+            if(compressed_size >= size) // Incompressible block is stored as is
+            {
+                std::memcpy(&compressed[4], data, size);
+                compressed_size = size;
+                block_header = static_cast<uint32_t>(size) | 0x80000000u;
+            }
+            for(int i = 0; i < 4; ++i)
+                compressed[i] = static_cast<unsigned char>(block_header >> (8 * i));
+            return Write(&compressed[0], 4 + compressed_size);
+        }
+
+        bool WriteEnd(std::vector<unsigned char>&)
+        {
+            const unsigned char end_mark[4] = {0, 0, 0, 0};
+            return Write(end_mark, sizeof(end_mark));
+        }
+
+        // XXH32 (seed 0) of short data (less than 16 bytes): checksum of the frame descriptor
+        static uint32_t HeaderHash(const unsigned char *data, size_t size)
+        {
+            const uint32_t PRIME1 = 2654435761u;
+            const uint32_t PRIME2 = 2246822519u;
+            const uint32_t PRIME3 = 3266489917u;
+            const uint32_t PRIME4 = 668265263u;
+            const uint32_t PRIME5 = 374761393u;
+            uint32_t h = PRIME5 + static_cast<uint32_t>(size);
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4)
+            {
+                const uint32_t word = static_cast<uint32_t>(data[i]) | (static_cast<uint32_t>(data[i + 1]) << 8) |
+                        (static_cast<uint32_t>(data[i + 2]) << 16) | (static_cast<uint32_t>(data[i + 3]) << 24);
+                h += word * PRIME3;
+                h = ((h << 17) | (h >> 15)) * PRIME4;
+            }
+            for(; i < size; ++i)
+            {
+                h += data[i] * PRIME5;
+                h = ((h << 11) | (h >> 21)) * PRIME1;
+            }
+            h ^= h >> 15;
+            h *= PRIME2;
+            h ^= h >> 13;
+            h *= PRIME3;
+            h ^= h >> 16;
+            return h;
+        }
+
+        // Built-in compressor of LZ4 block format: greedy matching of 4-byte sequences found via a hash table
+        // Returns the compressed size (the output buffer must have size + size / 255 + 16 bytes)
+        static size_t CompressLz4Block(const unsigned char *src, size_t size, unsigned char *dst)
+        {
+            const size_t MIN_MATCH = 4;
+            const size_t LAST_LITERALS = 5; // The last bytes of a block are always literals
+            const size_t MATCH_FIND_LIMIT = 12; // A match can not start closer to the end of a block
+            const size_t MAX_OFFSET = 65535;
+            const int HASH_LOG = 14;
+            unsigned char *out = dst;
+            size_t anchor = 0;
+            size_t pos = 0;
+            if(size > MATCH_FIND_LIMIT)
+            {
+                std::vector<uint32_t> table(static_cast<size_t>(1) << HASH_LOG, 0);
+                const size_t search_end = size - MATCH_FIND_LIMIT;
+                const size_t match_end = size - LAST_LITERALS;
+                while(pos <= search_end)
+                {
+                    const uint32_t sequence = Read32(src + pos);
+                    const uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_LOG);
+                    const size_t candidate = table[hash];
+                    table[hash] = static_cast<uint32_t>(pos);
+                    if(candidate >= pos || pos - candidate > MAX_OFFSET || Read32(src + candidate)!=sequence)
+                    {
+                        pos += 1 + ((pos - anchor) >> 6); // Skip faster through incompressible data
+                        continue;
+                    }
+                    size_t length = MIN_MATCH;
+                    while(pos + length < match_end && src[candidate + length]==src[pos + length])
+                        ++length;
+                    out = WriteSequence(out, src + anchor, pos - anchor, pos - candidate, length - MIN_MATCH);
+                    pos += length;
+                    anchor = pos;
+                }
+            }
+            // Last literals
+            const size_t literals = size - anchor;
+            *out++ = static_cast<unsigned char>((literals < 15 ? literals : 15) << 4);
+            out = WriteLength(out, literals);
+            std::memcpy(out, src + anchor, literals);
+            out += literals;
+            return static_cast<size_t>(out - dst);
+        }
+
+        // Writes LZ4 sequence: token, literals, offset and match length
+        static unsigned char* WriteSequence(unsigned char *out, const unsigned char *literals, size_t literals_size,
+                                            size_t offset, size_t match_length)
+        {
+            *out++ = static_cast<unsigned char>(((literals_size < 15 ? literals_size : 15) << 4) |
+                                                (match_length < 15 ? match_length : 15));
+            out = WriteLength(out, literals_size);
+            std::memcpy(out, literals, literals_size);
+            out += literals_size;
+            *out++ = static_cast<unsigned char>(offset & 0xFF);
+            *out++ = static_cast<unsigned char>(offset >> 8);
+            return WriteLength(out, match_length);
+        }
+
+        // Writes the rest of the length which does not fit into the token
+        static unsigned char* WriteLength(unsigned char *out, size_t length)
+        {
+            if(length < 15)
+                return out;
+            for(length -= 15; length >= 255; length -= 255)
+                *out++ = 255;
+            *out++ = static_cast<unsigned char>(length);
+            return out;
+        }
+
+        static uint32_t Read32(const unsigned char *p)
+        {
+            uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+#endif
+};
+
+#endif // FORMAT_UTIL_COMPRESS_H_INCLUDED
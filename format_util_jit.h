@@ -0,0 +1,316 @@
+#ifndef FORMAT_UTIL_JIT_H_INCLUDED
+#define FORMAT_UTIL_JIT_H_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "format_util.h"
+
+// Native code generation for hot templates is enabled by defining FORMAT_UTIL_JIT before including the header.
+// It is supported on x86-64 with the System V calling convention (Linux, BSD, macOS);
+// on other platforms and when the code cannot be generated the templates are interpreted.
+#if defined(FORMAT_UTIL_JIT) && defined(__x86_64__) && !defined(_WIN32)
+    #define FORMAT_UTIL_JIT_X86_64 1
+    #include <sys/mman.h>
+    #include <unistd.h>
+#else
+    #define FORMAT_UTIL_JIT_X86_64 0
+#endif
+
+///\brief Native code for filling a compiled template with text fields (x86-64).
+///\details The generated function writes the literal parts with immediate stores
+/// (long parts are copied by memcpy from the template) and copies the fields by direct memcpy calls,
+/// without walking the part table of the template. The code is placed into memory which is
+/// writable while it is generated and only executable after that.
+/// 'Valid' returns false if the code generation is not available (see FORMAT_UTIL_JIT).
+class JitTemplate
+{
+    public:
+        typedef FormatTemplate::Field Field;
+
+        ///\param tmpl - compiled template (it must outlive the generated code)
+        explicit JitTemplate(const FormatTemplate &tmpl)
+           : m_code(nullptr),
+             m_code_size(0),
+             m_function(nullptr)
+        {
+#if FORMAT_UTIL_JIT_X86_64
+            Generate(tmpl);
+#else
+            (void)tmpl;
+#endif
+        }
+
+        ~JitTemplate()
+        {
+#if FORMAT_UTIL_JIT_X86_64
+            if(m_code)
+                munmap(m_code, m_code_size);
+#endif
+        }
+
+        JitTemplate(const JitTemplate&) = delete;
+        JitTemplate& operator=(const JitTemplate&) = delete;
+
+        /// Returns true if the native code is generated
+        bool Valid() const
+        {
+            return m_function!=nullptr;
+        }
+
+        ///\brief Writes the template filled with fields into the buffer.
+        /// There must be a field for each format specifier, and the buffer must have room
+        /// for the literal parts and all fields.
+        ///\param out - output buffer
+        ///\param fields - array of fields
+        ///\return Pointer past the written output
+        char* Render(char *out, const Field *fields) const
+        {
+            return m_function(out, fields);
+        }
+
+    private:
+        typedef char* (*Function)(char*, const Field*);
+
+        void *m_code;
+        size_t m_code_size;
+        Function m_function;
+
+#if FORMAT_UTIL_JIT_X86_64
+        // Literal parts longer than this are copied by memcpy instead of immediate stores
+        static const size_t MAX_IMMEDIATE_PART = 256;
+
+        // Generated function: char* Render(char *out, const Field *fields)
+        // rbx - output position, r12 - fields, r13 - size of the current field
+        void Generate(const FormatTemplate &tmpl)
+        {
+            std::vector<unsigned char> code;
+            code.insert(code.end(), {0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13
+            code.insert(code.end(), {0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4}); // mov rbx, rdi; mov r12, rsi
+            for(size_t i = 0; i <= tmpl.Specifiers(); ++i)
+            {
+                size_t size;
+                const char *part = tmpl.Part(i, size);
+                if(size > MAX_IMMEDIATE_PART)
+                    EmitCopyPart(code, part, size);
+                else
+                    EmitStores(code, part, size);
+                if(i < tmpl.Specifiers())
+                    EmitCopyField(code, i);
+            }
+            code.insert(code.end(), {0x48, 0x89, 0xD8}); // mov rax, rbx
+            code.insert(code.end(), {0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r13; pop r12; pop rbx; ret
+
+            const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            const size_t size = (code.size() + page - 1) / page * page;
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(memory==MAP_FAILED)
+                return;
+            std::memcpy(memory, code.data(), code.size());
+            if(mprotect(memory, size, PROT_READ | PROT_EXEC)!=0)
+            {
+                munmap(memory, size);
+                return;
+            }
+            m_code = memory;
+            m_code_size = size;
+            m_function = reinterpret_cast<Function>(memory);
+        }
+
+        // Writes the literal part with immediate stores and moves the output position
+        static void EmitStores(std::vector<unsigned char> &code, const char *part, size_t size)
+        {
+            uint32_t offset = 0;
+            for(; size - offset >= 8; offset += 8)
+            {
+                code.insert(code.end(), {0x48, 0xB8}); // mov rax, imm64
+                Emit(code, part + offset, 8);
+                code.insert(code.end(), {0x48, 0x89, 0x83}); // mov [rbx + disp32], rax
+                Emit32(code, offset);
+            }
+            if(size - offset >= 4)
+            {
+                code.insert(code.end(), {0xC7, 0x83}); // mov dword [rbx + disp32], imm32
+                Emit32(code, offset);
+                Emit(code, part + offset, 4);
+                offset += 4;
+            }
+            if(size - offset >= 2)
+            {
+                code.insert(code.end(), {0x66, 0xC7, 0x83}); // mov word [rbx + disp32], imm16
+                Emit32(code, offset);
+                Emit(code, part + offset, 2);
+                offset += 2;
+            }
+            if(size - offset >= 1)
+            {
+                code.insert(code.end(), {0xC6, 0x83}); // mov byte [rbx + disp32], imm8
+                Emit32(code, offset);
+                Emit(code, part + offset, 1);
+            }
+            EmitAdvance(code, size);
+        }
+
+        // Copies the long literal part by memcpy and moves the output position
+        static void EmitCopyPart(std::vector<unsigned char> &code, const char *part, size_t size)
+        {
+            code.insert(code.end(), {0x48, 0x89, 0xDF}); // mov rdi, rbx
+            code.insert(code.end(), {0x48, 0xBE}); // mov rsi, imm64
+            const uint64_t address = reinterpret_cast<uintptr_t>(part);
+            Emit(code, &address, 8);
+            code.insert(code.end(), {0x48, 0xBA}); // mov rdx, imm64
+            const uint64_t length = size;
+            Emit(code, &length, 8);
+            EmitCallMemcpy(code);
+            EmitAdvance(code, size);
+        }
+
+        // Copies the field by memcpy and moves the output position by its size
+        static void EmitCopyField(std::vector<unsigned char> &code, size_t index)
+        {
+            const uint32_t offset = static_cast<uint32_t>(index * sizeof(Field));
+            code.insert(code.end(), {0x48, 0x89, 0xDF}); // mov rdi, rbx
+            code.insert(code.end(), {0x49, 0x8B, 0xB4, 0x24}); // mov rsi, [r12 + disp32]
+            Emit32(code, offset + static_cast<uint32_t>(offsetof(Field, data)));
+            code.insert(code.end(), {0x49, 0x8B, 0x94, 0x24}); // mov rdx, [r12 + disp32]
+            Emit32(code, offset + static_cast<uint32_t>(offsetof(Field, size)));
+            code.insert(code.end(), {0x49, 0x89, 0xD5}); // mov r13, rdx
+            EmitCallMemcpy(code);
+            code.insert(code.end(), {0x4C, 0x01, 0xEB}); // add rbx, r13
+        }
+
+        static void EmitCallMemcpy(std::vector<unsigned char> &code)
+        {
+            void* (*function)(void*, const void*, size_t) = &std::memcpy;
+            const uint64_t address = reinterpret_cast<uintptr_t>(function);
+            code.insert(code.end(), {0x48, 0xB8}); // mov rax, imm64
+            Emit(code, &address, 8);
+            code.insert(code.end(), {0xFF, 0xD0}); // call rax
+        }
+
+        static void EmitAdvance(std::vector<unsigned char> &code, size_t size)
+        {
+            if(size==0)
+                return;
+            code.insert(code.end(), {0x48, 0x81, 0xC3}); // add rbx, imm32
+            Emit32(code, static_cast<uint32_t>(size));
+        }
+
+        static void Emit32(std::vector<unsigned char> &code, uint32_t value)
+        {
+            Emit(code, &value, 4);
+        }
+
+        // Appends bytes in memory order (x86-64 immediates are little-endian)
+        static void Emit(std::vector<unsigned char> &code, const void *data, size_t size)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char*>(data);
+            code.insert(code.end(), bytes, bytes + size);
+        }
+#endif
+};
+
+///\brief Template which is interpreted until it becomes hot, then it is filled by native code.
+///\details Calls are counted; when the counter reaches the threshold, native code is generated
+/// for the template (see JitTemplate). The interpreter (Formatter::FormatFieldsTo) remains
+/// the fallback: it is used before the threshold, when the code generation is not available,
+/// when some fields are missing and when the formatter validates UTF-8 text.
+/// The output is the same in all cases. The class is thread-safe.
+/// Example:
+///    HotTemplate tmpl(formatter.Compile(catalogue_text));
+///    tmpl.FormatFieldsTo(formatter, output, fields, count);
+///
+class HotTemplate
+{
+    public:
+        typedef FormatTemplate::Field Field;
+
+        ///\param tmpl - compiled template
+        ///\param threshold - number of calls after which native code is generated
+        explicit HotTemplate(FormatTemplate tmpl, uint64_t threshold = 1000)
+           : m_tmpl(std::move(tmpl)),
+             m_threshold(threshold),
+             m_calls(0),
+             m_jit(nullptr),
+             m_jit_failed(false)
+        { }
+
+        ///\brief Appends the template filled with text fields to the string.
+        ///\param formatter - formatter for the interpreted output
+        ///\param out - output string
+        ///\param fields - array of fields
+        ///\param count - number of fields
+        void FormatFieldsTo(Formatter &formatter, std::string &out, const Field *fields, size_t count)
+        {
+            const JitTemplate *jit = Code();
+            if(!jit || count < m_tmpl.Specifiers() || count==0 || formatter.Utf8()!=Formatter::Utf8Mode::Pass)
+            {
+                formatter.FormatFieldsTo(out, m_tmpl, fields, count);
+                return;
+            }
+            size_t size = 0;
+            for(size_t i = 0; i <= m_tmpl.Specifiers(); ++i)
+            {
+                size_t part_size;
+                m_tmpl.Part(i, part_size);
+                size += part_size;
+                if(i < m_tmpl.Specifiers())
+                    size += fields[i].size;
+            }
+            const size_t old_size = out.size();
+            out.resize(old_size + size);
+            jit->Render(&out[old_size], fields);
+        }
+
+        /// Returns the compiled template
+        const FormatTemplate& Template() const
+        {
+            return m_tmpl;
+        }
+
+        /// Returns true if the template is filled by native code
+        bool Native() const
+        {
+            return m_jit.load(std::memory_order_acquire)!=nullptr;
+        }
+
+    private:
+        const FormatTemplate m_tmpl;
+        const uint64_t m_threshold;
+        std::atomic<uint64_t> m_calls;
+        std::atomic<const JitTemplate*> m_jit;
+        std::unique_ptr<JitTemplate> m_jit_owner;
+        // Set when the code cannot be generated: the template is interpreted without locking
+        std::atomic<bool> m_jit_failed;
+        std::mutex m_mutex;
+
+        // Counts the call and returns the native code if it is generated
+        const JitTemplate* Code()
+        {
+            const JitTemplate *jit = m_jit.load(std::memory_order_acquire);
+            if(jit || !FORMAT_UTIL_JIT_X86_64)
+                return jit;
+            if(m_jit_failed.load(std::memory_order_acquire) ||
+               m_calls.fetch_add(1, std::memory_order_relaxed) + 1 < m_threshold)
+                return nullptr;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!m_jit_owner && !m_jit_failed.load(std::memory_order_relaxed))
+            {
+                std::unique_ptr<JitTemplate> generated(new JitTemplate(m_tmpl));
+                if(generated->Valid())
+                {
+                    m_jit_owner = std::move(generated);
+                    m_jit.store(m_jit_owner.get(), std::memory_order_release);
+                }
+                else
+                    m_jit_failed.store(true, std::memory_order_release);
+            }
+            return m_jit.load(std::memory_order_relaxed);
+        }
+};
+
+#endif // FORMAT_UTIL_JIT_H_INCLUDED
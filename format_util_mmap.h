@@ -0,0 +1,284 @@
+#ifndef FORMAT_UTIL_MMAP_H_INCLUDED
+#define FORMAT_UTIL_MMAP_H_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "format_util.h"
+
+///\brief Output file written through a memory mapping (POSIX).
+///\details The formatted output is written directly into the page cache via the mapping:
+/// there are no write() calls and no copies of the output in user space.
+/// The whole address range for the file ('max_size') is mapped once, and the file is extended
+/// in large steps while the output grows. The disk space is allocated when the file is extended
+/// (posix_fallocate), so a full disk is reported via 'Good' instead of SIGBUS on a later store.
+/// The mapping is never moved,
+/// so several threads may write into the file at the same time: each writer claims
+/// a disjoint region via an atomic cursor. A failed claim does not move the cursor,
+/// so the output has no gaps.
+/// On close the file is truncated to the size of the written output.
+/// Errors are not thrown: 'Good' returns false after the first failure.
+/// Example (single writer):
+///    MmapFile file("export.txt");
+///    MmapSink sink(file);
+///    for(const Row &row : rows)
+///        formatter.FormatTo(sink, "%?\t%?\n", row.id, row.name);
+/// Example (parallel writers, each line is written as a whole):
+///    file.Format(formatter, "%?\t%?\n", row.id, row.name);
+/// Each thread may also use its own MmapSink: its messages are written as whole batches.
+///
+class MmapFile
+{
+    public:
+        ///\param path - path of the output file (it is created or truncated)
+        ///\param max_size - maximum size of the output (the size of the address range reserved for the file)
+        ///\param grow_step - the file is extended by this size when the output reaches its end
+        explicit MmapFile(const char *path,
+                          uint64_t max_size = DefaultMaxSize(),
+                          uint64_t grow_step = 64 * 1024 * 1024)
+           : m_fd(-1),
+             m_base(nullptr),
+             m_max_size(max_size),
+             m_grow_step(grow_step > 0 ? grow_step : 1),
+             m_cursor(0),
+             m_file_size(0),
+             m_good(false)
+        {
+            m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(m_fd < 0)
+                return;
+            void *base = mmap(nullptr, static_cast<size_t>(m_max_size), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+            if(base==MAP_FAILED)
+                return;
+            m_base = static_cast<char*>(base);
+            m_good.store(true);
+        }
+
+        ~MmapFile()
+        {
+            Close();
+        }
+
+        MmapFile(const MmapFile&) = delete;
+        MmapFile& operator=(const MmapFile&) = delete;
+
+        /// Claims the region of the given size at the end of the output. Thread-safe.
+        /// The file is extended before the cursor is moved: if the claim fails, the cursor stays
+        /// where it was and the file is marked as failed.
+        ///\param size - size of the region
+        ///\return Pointer to the region or nullptr on error (the file is full or cannot be extended)
+        char* Claim(size_t size)
+        {
+            uint64_t offset = m_cursor.load(std::memory_order_relaxed);
+            uint64_t end;
+            do
+            {
+                if(!m_good.load(std::memory_order_relaxed))
+                    return nullptr;
+                end = offset + size;
+                if(end > m_max_size)
+                {
+                    m_good.store(false);
+                    return nullptr;
+                }
+                if(end > m_file_size.load(std::memory_order_acquire) && !Grow(end))
+                    return nullptr;
+            }
+            while(!m_cursor.compare_exchange_weak(offset, end, std::memory_order_relaxed));
+            return m_base + offset;
+        }
+
+        ///\brief Writes char sequence filled with parameters into the file as one region. Thread-safe.
+        /// The output is formatted once into a buffer of the thread (its memory is kept for the next
+        /// outputs within the limit of BufferRetention), then the region of its size is claimed
+        /// and the output is copied into it.
+        ///\param formatter - formatter for the output (Formatter, PolicyFormatter, ContextFormatter)
+        ///\param seq - pointer to sequence
+        ///\param args - list of arguments
+        ///\return true on success
+        template<typename F, typename... Args>
+        bool Format(F &formatter, const char *seq, const Args&... args)
+        {
+            MessageBuffer &buffer = ThreadBuffer();
+            formatter.FormatTo(buffer.text, seq, args...);
+            char *region = Claim(buffer.text.size());
+            if(region)
+                std::memcpy(region, buffer.text.data(), buffer.text.size());
+            buffer.retention.Recycle(buffer.text);
+            return region!=nullptr;
+        }
+
+        /// Returns size of the claimed output
+        uint64_t Size() const
+        {
+            const uint64_t size = m_cursor.load();
+            return size < m_max_size ? size : m_max_size;
+        }
+
+        bool Good() const
+        {
+            return m_good.load();
+        }
+
+        /// Unmaps the file and truncates it to the size of the output.
+        /// The file must not be written after closing.
+        ///\return true if there were no errors
+        bool Close()
+        {
+            if(m_fd < 0)
+                return false;
+            bool ok = m_good.load();
+            if(m_base)
+            {
+                munmap(m_base, static_cast<size_t>(m_max_size));
+                m_base = nullptr;
+            }
+            if(ftruncate(m_fd, static_cast<off_t>(Size()))!=0)
+                ok = false;
+            close(m_fd);
+            m_fd = -1;
+            m_good.store(false);
+            return ok;
+        }
+
+        /// Default maximum size of the output: 1 TiB for 64-bit platforms, 1 GiB for 32-bit ones
+        static uint64_t DefaultMaxSize()
+        {
+            return sizeof(void*) >= 8 ? (1ULL << 40) : (1ULL << 30);
+        }
+
+    private:
+        // Output of 'Format' in the current thread
+        struct MessageBuffer
+        {
+            std::string text;
+            BufferRetention retention;
+        };
+
+        static MessageBuffer& ThreadBuffer()
+        {
+            static thread_local MessageBuffer buffer;
+            return buffer;
+        }
+
+        int m_fd;
+        char *m_base;
+        const uint64_t m_max_size;
+        const uint64_t m_grow_step;
+        // End of the claimed output
+        std::atomic<uint64_t> m_cursor;
+        // Current size of the file, the mapping is valid up to this size
+        std::atomic<uint64_t> m_file_size;
+        std::atomic<bool> m_good;
+        std::mutex m_grow_mutex;
+
+        // Extends the file to cover the output up to the given end
+        bool Grow(uint64_t end)
+        {
+            std::lock_guard<std::mutex> lock(m_grow_mutex);
+            uint64_t file_size = m_file_size.load(std::memory_order_relaxed);
+            if(end <= file_size)
+                return true;
+            uint64_t new_size = (end + m_grow_step - 1) / m_grow_step * m_grow_step;
+            if(new_size > m_max_size)
+                new_size = m_max_size;
+            int result = Allocate(file_size, new_size);
+            if(result!=0)
+            {
+                m_good.store(false);
+                return false;
+            }
+            m_file_size.store(new_size, std::memory_order_release);
+            return true;
+        }
+
+        // Extends the file from the current size to the new one allocating the disk space.
+        // Without posix_fallocate (macOS) or when the file system cannot allocate space in advance
+        // the file is extended by ftruncate (it is sparse then).
+        // Returns 0 or the error code.
+        int Allocate(uint64_t file_size, uint64_t new_size)
+        {
+            int result;
+#ifndef __APPLE__
+            do
+            {
+                result = posix_fallocate(m_fd, static_cast<off_t>(file_size), static_cast<off_t>(new_size - file_size));
+            }
+            while(result==EINTR);
+            if(result!=EINVAL && result!=EOPNOTSUPP)
+                return result;
+#else
+            (void)file_size;
+#endif
+            do
+            {
+                result = ftruncate(m_fd, static_cast<off_t>(new_size));
+            }
+            while(result!=0 && errno==EINTR);
+            return result!=0 ? errno : 0;
+        }
+};
+
+///\brief Sink which writes the output into a memory-mapped file (see MmapFile).
+///\details Messages are collected in a buffer and written as a batch with one claim,
+/// so a message is never split between regions, also when several sinks write into the same file.
+/// The batch is written when a new message starts and the batch has reached 'batch_size',
+/// by 'Commit' and on destruction. A sink is used by one thread.
+class MmapSink
+{
+    public:
+        ///\param file - output file
+        ///\param batch_size - size of the messages collected before they are written
+        explicit MmapSink(MmapFile &file, size_t batch_size = 64 * 1024)
+           : m_file(file),
+             m_batch_size(batch_size)
+        { }
+
+        ~MmapSink()
+        {
+            Commit();
+        }
+
+        MmapSink(const MmapSink&) = delete;
+        MmapSink& operator=(const MmapSink&) = delete;
+
+        // Is called by the formatter before each message: the previous messages are complete
+        void Reserve(size_t)
+        {
+            if(m_buffer.size() >= m_batch_size)
+                Commit();
+        }
+
+        void Append(const char *data, size_t size)
+        {
+            m_buffer.append(data, size);
+        }
+
+        /// Writes the collected messages into the file as one region.
+        /// Must not be called in the middle of a message.
+        ///\return true on success
+        bool Commit()
+        {
+            if(m_buffer.empty())
+                return m_file.Good();
+            char *region = m_file.Claim(m_buffer.size());
+            if(region)
+                std::memcpy(region, m_buffer.data(), m_buffer.size());
+            m_buffer.clear();
+            return region!=nullptr;
+        }
+
+    private:
+        MmapFile &m_file;
+        const size_t m_batch_size;
+        std::string m_buffer;
+};
+
+#endif // FORMAT_UTIL_MMAP_H_INCLUDED
@@ -0,0 +1,323 @@
+#ifndef FORMAT_UTIL_STORE_H_INCLUDED
+#define FORMAT_UTIL_STORE_H_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include "format_util.h"
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+#endif
+
+///\brief Store of format templates loaded from the files of a directory (POSIX, watching on Linux).
+///\details Each regular file of the directory is a template, its name is the file name.
+/// Hidden files and leftovers of editors are ignored: names which start with '.' or '#',
+/// end with '~' or have the extension '.swp', '.swo', '.swx', '.tmp' or '.bak'.
+/// The templates are compiled when they are loaded (see Formatter::Compile).
+/// 'Watch' starts a background thread which watches the directory via inotify: changed, new
+/// and removed files are reloaded off the hot path and published by atomic pointer swaps.
+/// Readers never block and never see a partially updated template: 'Find' returns either
+/// the previous or the new compiled template. Replaced templates are kept until the store
+/// is destroyed, so the returned pointers stay valid for the lifetime of the store
+/// (the memory grows only by the templates which are changed: a file with the same size
+/// and modification time or with the same content is not loaded again).
+/// Files should be replaced atomically (written to a temporary file and renamed),
+/// otherwise a template may be loaded while the file is being written and reloaded once it is closed.
+/// Example:
+///    TemplateStore store("/etc/myapp/templates");
+///    store.Watch();
+///    ...
+///    if(const FormatTemplate *tmpl = store.Find("login.txt"))
+///        formatter.FormatTo(output, *tmpl, user, host);
+///
+class TemplateStore
+{
+    public:
+        ///\param directory - directory with template files (they are loaded at once)
+        explicit TemplateStore(const std::string &directory)
+           : m_directory(directory),
+             m_index(new Index()),
+             m_version(0),
+             m_good(false),
+             m_watch_fd(-1)
+        {
+            m_stop_pipe[0] = m_stop_pipe[1] = -1;
+            m_good = Reload();
+        }
+
+        ~TemplateStore()
+        {
+            StopWatching();
+            delete m_index.load();
+        }
+
+        TemplateStore(const TemplateStore&) = delete;
+        TemplateStore& operator=(const TemplateStore&) = delete;
+
+        ///\brief Returns the current compiled template. Never blocks.
+        ///\param name - file name of the template
+        ///\return Pointer to the template (valid while the store exists) or nullptr if there is no such template
+        const FormatTemplate* Find(const std::string &name) const
+        {
+            const Index *index = m_index.load(std::memory_order_acquire);
+            const Index::const_iterator it = index->find(name);
+            return it==index->end() ? nullptr : it->second->load(std::memory_order_acquire);
+        }
+
+        /// Returns number of published template changes
+        uint64_t Version() const
+        {
+            return m_version.load(std::memory_order_acquire);
+        }
+
+        /// Returns false if the directory could not be read
+        bool Good() const
+        {
+            return m_good;
+        }
+
+        ///\brief Reloads all templates of the directory (templates of removed files are removed).
+        ///\return false if the directory could not be read
+        bool Reload()
+        {
+            DIR *dir = opendir(m_directory.c_str());
+            if(!dir)
+                return false;
+            std::vector<std::string> names;
+            while(dirent *entry = readdir(dir))
+            {
+                if(!Ignored(entry->d_name))
+                    names.push_back(entry->d_name);
+            }
+            closedir(dir);
+            std::lock_guard<std::mutex> lock(m_write_mutex);
+            const Index *index = m_index.load(std::memory_order_relaxed);
+            for(const Index::value_type &entry : *index)
+            {
+                if(std::find(names.begin(), names.end(), entry.first)==names.end())
+                    Publish(entry.first, nullptr);
+            }
+            for(const std::string &name : names)
+                LoadFile(name);
+            return true;
+        }
+
+        ///\brief Starts watching the directory for changes in a background thread (Linux).
+        ///\return false if watching is not available
+        bool Watch()
+        {
+#ifdef __linux__
+            if(m_watcher.joinable())
+                return true;
+            m_watch_fd = inotify_init1(IN_CLOEXEC);
+            if(m_watch_fd < 0)
+                return false;
+            if(inotify_add_watch(m_watch_fd, m_directory.c_str(),
+                                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)< 0 ||
+               pipe(m_stop_pipe)!=0)
+            {
+                close(m_watch_fd);
+                m_watch_fd = -1;
+                return false;
+            }
+            m_watcher = std::thread(&TemplateStore::WatchLoop, this);
+            return true;
+#else
+            return false;
+#endif
+        }
+
+    private:
+        // Size and modification time of a loaded file
+        struct FileState
+        {
+            off_t size;
+            time_t mtime;
+            long mtime_nsec;
+
+            bool operator==(const FileState &other) const
+            {
+                return size==other.size && mtime==other.mtime && mtime_nsec==other.mtime_nsec;
+            }
+        };
+
+        // Current version of a template, nullptr if the file is removed
+        typedef std::atomic<const FormatTemplate*> Slot;
+        // Slots by names. The index is never changed after it is published:
+        // a new index is published when a new name appears.
+        typedef std::map<std::string, Slot*> Index;
+
+        const std::string m_directory;
+        std::atomic<const Index*> m_index;
+        std::atomic<uint64_t> m_version;
+        bool m_good;
+        // Writers (reload and watcher thread) are serialized, readers do not use the mutex
+        std::mutex m_write_mutex;
+        Formatter m_compiler;
+        // All slots, templates and replaced indexes, they are released with the store
+        std::vector<std::unique_ptr<Slot>> m_slots;
+        std::vector<std::unique_ptr<const FormatTemplate>> m_templates;
+        std::vector<std::unique_ptr<const Index>> m_retired_indexes;
+        // State of the loaded files, it is used by writers only
+        std::map<std::string, FileState> m_files;
+        int m_watch_fd;
+        int m_stop_pipe[2];
+        std::thread m_watcher;
+
+        // Returns true for names of hidden files and of files left by editors
+        static bool Ignored(const std::string &name)
+        {
+            static const char* const extensions[] = {".swp", ".swo", ".swx", ".tmp", ".bak"};
+            if(name.empty() || name[0]=='.' || name[0]=='#' || name[name.size() - 1]=='~')
+                return true;
+            for(const char *extension : extensions)
+            {
+                const size_t size = std::strlen(extension);
+                if(name.size() > size && name.compare(name.size() - size, size, extension)==0)
+                    return true;
+            }
+            return false;
+        }
+
+        // Loads and publishes the template of the file (the write mutex must be held).
+        // Unchanged files (the same size and modification time or the same content) are not published.
+        void LoadFile(const std::string &name)
+        {
+            const std::string path = m_directory + "/" + name;
+            struct stat st;
+            if(stat(path.c_str(), &st)!=0 || !S_ISREG(st.st_mode))
+            {
+                Publish(name, nullptr);
+                return;
+            }
+#ifdef __APPLE__
+            const FileState state = {st.st_size, st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec};
+#else
+            const FileState state = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+#endif
+            const FormatTemplate *current = Current(name);
+            const std::map<std::string, FileState>::const_iterator loaded = m_files.find(name);
+            if(current && loaded!=m_files.end() && loaded->second==state)
+                return;
+            std::ifstream file(path.c_str(), std::ios::binary);
+            if(!file)
+                return; // The previous version is kept
+            const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            m_files[name] = state;
+            if(current && current->Source()==text)
+                return;
+            std::unique_ptr<const FormatTemplate> tmpl(new FormatTemplate(m_compiler.Compile(text)));
+            Publish(name, tmpl.get());
+            m_templates.push_back(std::move(tmpl));
+        }
+
+        // Returns the published template (the write mutex must be held)
+        const FormatTemplate* Current(const std::string &name) const
+        {
+            const Index *index = m_index.load(std::memory_order_relaxed);
+            const Index::const_iterator it = index->find(name);
+            return it==index->end() ? nullptr : it->second->load(std::memory_order_relaxed);
+        }
+
+        // Publishes the new version of the template (the write mutex must be held)
+        void Publish(const std::string &name, const FormatTemplate *tmpl)
+        {
+            if(!tmpl)
+                m_files.erase(name);
+            const Index *index = m_index.load(std::memory_order_relaxed);
+            Index::const_iterator it = index->find(name);
+            if(it==index->end())
+            {
+                if(!tmpl)
+                    return;
+                m_slots.push_back(std::unique_ptr<Slot>(new Slot(nullptr)));
+                std::unique_ptr<Index> updated(new Index(*index));
+                it = updated->insert(Index::value_type(name, m_slots.back().get())).first;
+                m_index.store(updated.release(), std::memory_order_release);
+                m_retired_indexes.push_back(std::unique_ptr<const Index>(index));
+            }
+            else if(it->second->load(std::memory_order_relaxed)==tmpl)
+                return;
+            it->second->store(tmpl, std::memory_order_release);
+            m_version.fetch_add(1, std::memory_order_release);
+        }
+
+#ifdef __linux__
+        // Watcher thread: reloads the changed files
+        void WatchLoop()
+        {
+            alignas(inotify_event) char buffer[16 * 1024];
+            for(;;)
+            {
+                pollfd fds[2] = {{m_watch_fd, POLLIN, 0}, {m_stop_pipe[0], POLLIN, 0}};
+                if(poll(fds, 2, -1) < 0)
+                {
+                    if(errno==EINTR)
+                        continue;
+                    return;
+                }
+                if(fds[1].revents)
+                    return;
+                const ssize_t size = read(m_watch_fd, buffer, sizeof(buffer));
+                if(size <= 0)
+                {
+                    if(size < 0 && errno==EINTR)
+                        continue;
+                    return;
+                }
+                bool overflow = false;
+                {
+                    std::lock_guard<std::mutex> lock(m_write_mutex);
+                    for(ssize_t pos = 0; pos < size; )
+                    {
+                        const inotify_event *event = reinterpret_cast<const inotify_event*>(buffer + pos);
+                        pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                        if(event->mask & IN_Q_OVERFLOW)
+                            overflow = true;
+                        if(event->len==0 || Ignored(event->name))
+                            continue;
+                        if(event->mask & (IN_MOVED_FROM | IN_DELETE))
+                            Publish(event->name, nullptr);
+                        else
+                            LoadFile(event->name);
+                    }
+                }
+                // Events are lost: the whole directory is reloaded
+                if(overflow)
+                    Reload();
+            }
+        }
+#endif
+
+        void StopWatching()
+        {
+            if(m_watcher.joinable())
+            {
+                const char stop = 0;
+                while(write(m_stop_pipe[1], &stop, 1) < 0 && errno==EINTR)
+                { }
+                m_watcher.join();
+            }
+            for(int fd : {m_watch_fd, m_stop_pipe[0], m_stop_pipe[1]})
+            {
+                if(fd >= 0)
+                    close(fd);
+            }
+        }
+};
+
+#endif // FORMAT_UTIL_STORE_H_INCLUDED
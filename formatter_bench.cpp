@@ -0,0 +1,381 @@
+// formatter-bench: runs benchmark workloads of the formatter and reports time and hardware counters per call (Linux).
+//
+// Build:
+//     g++ -std=c++17 -O2 formatter_bench.cpp -o formatter-bench
+// Usage:
+//     formatter-bench [-n CALLS] [WORKLOAD...]
+// Without workload names all workloads are run. Each workload is warmed up and then called CALLS times
+// (1000000 by default) between PerfCounters::Start and Stop; the report gives the time per call and,
+// if the counters are permitted (see /proc/sys/kernel/perf_event_paranoid), IPC and counts per call.
+// IP, MAC and UUID workloads are paired with the same output via inet_ntop and snprintf
+// ('ipv6' and 'ipv6 inet_ntop' etc.), number workloads with the output via std::ostringstream
+// ('integers' and 'integers stream'). The number conversion depends on the standard level: build with
+// -std=c++11 or -DFORMAT_UTIL_TO_CHARS=0 to measure the built-in code instead of std::to_chars.
+// Example:
+//     formatter-bench -n 2000000 "short lines" maps
+//     C++ 201703, numbers are converted via std::to_chars
+//     short lines: 45.7 ns per call
+//     short lines: IPC 3.41, per call: 173 cycles, 590 instructions, 0.01 branch misses, 0 L1D misses, 0 LLC misses
+//     maps: 1.05 us per call
+//     ...
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include "format_util.h"
+#include "format_util_perf.h"
+
+namespace
+{
+
+struct Options
+{
+    uint64_t calls = 1000000;
+    std::vector<std::string> workloads;
+};
+
+void PrintUsage()
+{
+    std::fprintf(stderr,
+        "Usage: formatter-bench [-n CALLS] [WORKLOAD...]\n"
+        "Options:\n"
+        "  -n CALLS   number of calls of each workload (default 1000000)\n");
+}
+
+bool ParseOptions(int argc, char **argv, Options &options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if(std::strcmp(arg, "-n")==0 && i + 1 < argc)
+            options.calls = std::strtoull(argv[++i], nullptr, 10);
+        else if(arg[0]=='-')
+            return false;
+        else
+            options.workloads.push_back(arg);
+    }
+    return options.calls > 0;
+}
+
+// Workloads return the total size of the output, so it is not optimized away
+
+// Short log lines with an integer and a string
+uint64_t ShortLines(uint64_t calls)
+{
+    Formatter formatter;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "User %? logged in from %?", static_cast<int>(i), "host.example.com");
+        total += out.size();
+    }
+    return total;
+}
+
+// Vector of 16 integers
+uint64_t Containers(uint64_t calls)
+{
+    Formatter formatter;
+    std::vector<int> values;
+    for(int i = 0; i < 16; ++i)
+        values.push_back(i * 1237);
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "Values: %?", values);
+        total += out.size();
+    }
+    return total;
+}
+
+// Map of 8 names to doubles
+uint64_t Maps(uint64_t calls)
+{
+    Formatter formatter;
+    std::map<std::string, double> totals;
+    for(int i = 0; i < 8; ++i)
+        totals[formatter.Format("account-%?", i)] = i * 101.25;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "Totals: %?", totals);
+        total += out.size();
+    }
+    return total;
+}
+
+// Wide strings and numbers into a wide string
+uint64_t WideStrings(uint64_t calls)
+{
+    Formatter formatter;
+    const std::wstring name = L"Jürgen Müller";
+    std::wstring out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, L"%? (%?) has %? items", name, L"customer", static_cast<unsigned>(i));
+        total += out.size();
+    }
+    return total;
+}
+
+// Integers converted directly (see FORMAT_UTIL_TO_CHARS)
+uint64_t Integers(uint64_t calls)
+{
+    Formatter formatter;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "id=%? size=%? delta=%?", static_cast<long long>(i * 7919), static_cast<unsigned>(i),
+                           -static_cast<int>(i % 100000));
+        total += out.size();
+    }
+    return total;
+}
+
+// The same output via the stream
+uint64_t IntegersStream(uint64_t calls)
+{
+    std::ostringstream stream;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        stream.str(std::string());
+        stream << "id=" << static_cast<long long>(i * 7919) << " size=" << static_cast<unsigned>(i)
+               << " delta=" << -static_cast<int>(i % 100000);
+        out = stream.str();
+        total += out.size();
+    }
+    return total;
+}
+
+// Doubles converted directly with the default precision
+uint64_t Doubles(uint64_t calls)
+{
+    Formatter formatter;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "x=%? y=%?", static_cast<double>(i) * 0.37, 1e-3 / static_cast<double>(i + 1));
+        total += out.size();
+    }
+    return total;
+}
+
+uint64_t DoublesStream(uint64_t calls)
+{
+    std::ostringstream stream;
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        stream.str(std::string());
+        stream << "x=" << static_cast<double>(i) * 0.37 << " y=" << 1e-3 / static_cast<double>(i + 1);
+        out = stream.str();
+        total += out.size();
+    }
+    return total;
+}
+
+// Binary identifiers: 256 pseudo-random 16-byte values, a quarter of them with zero runs
+const unsigned char* Identifiers()
+{
+    static unsigned char bytes[256][16];
+    static bool filled = false;
+    if(!filled)
+    {
+        uint32_t state = 12345;
+        for(int i = 0; i < 256; ++i)
+        {
+            for(int j = 0; j < 16; ++j)
+            {
+                state = state * 1103515245 + 12345;
+                bytes[i][j] = (i % 4==0 && j >= 4 && j < 12) ? 0 : static_cast<unsigned char>(state >> 16);
+            }
+        }
+        filled = true;
+    }
+    return bytes[0];
+}
+
+// Identifiers output by the formatter kernels
+template<Formatter::FBytes (*Kind)(const void*)>
+uint64_t FormatIdentifiers(uint64_t calls)
+{
+    Formatter formatter;
+    const unsigned char *bytes = Identifiers();
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        out.clear();
+        formatter.FormatTo(out, "%?", Kind(bytes + 16 * (i % 256)));
+        total += out.size();
+    }
+    return total;
+}
+
+// The same identifiers output by the C library
+template<int Family>
+uint64_t InetNtop(uint64_t calls)
+{
+    const unsigned char *bytes = Identifiers();
+    char text[INET6_ADDRSTRLEN];
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        inet_ntop(Family, bytes + 16 * (i % 256), text, sizeof(text));
+        out.clear();
+        out.append(text);
+        total += out.size();
+    }
+    return total;
+}
+
+uint64_t MacSnprintf(uint64_t calls)
+{
+    const unsigned char *bytes = Identifiers();
+    char text[32];
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        const unsigned char *b = bytes + 16 * (i % 256);
+        const int size = std::snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+                                       b[0], b[1], b[2], b[3], b[4], b[5]);
+        out.clear();
+        out.append(text, static_cast<size_t>(size));
+        total += out.size();
+    }
+    return total;
+}
+
+uint64_t UuidSnprintf(uint64_t calls)
+{
+    const unsigned char *bytes = Identifiers();
+    char text[40];
+    std::string out;
+    uint64_t total = 0;
+    for(uint64_t i = 0; i < calls; ++i)
+    {
+        const unsigned char *b = bytes + 16 * (i % 256);
+        const int size = std::snprintf(text, sizeof(text),
+                "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+        out.clear();
+        out.append(text, static_cast<size_t>(size));
+        total += out.size();
+    }
+    return total;
+}
+
+struct Workload
+{
+    const char *name;
+    uint64_t (*run)(uint64_t calls);
+};
+
+const Workload WORKLOADS[] = {
+    {"short lines", ShortLines},
+    {"containers", Containers},
+    {"maps", Maps},
+    {"wide strings", WideStrings},
+    {"integers", Integers},
+    {"integers stream", IntegersStream},
+    {"doubles", Doubles},
+    {"doubles stream", DoublesStream},
+    {"ipv4", FormatIdentifiers<Formatter::IPv4>},
+    {"ipv4 inet_ntop", InetNtop<AF_INET>},
+    {"ipv6", FormatIdentifiers<Formatter::IPv6>},
+    {"ipv6 inet_ntop", InetNtop<AF_INET6>},
+    {"mac", FormatIdentifiers<Formatter::Mac>},
+    {"mac snprintf", MacSnprintf},
+    {"uuid", FormatIdentifiers<Formatter::Uuid>},
+    {"uuid snprintf", UuidSnprintf},
+};
+
+// Time per call: '48.2 ns', '1.03 us'
+std::string PerCall(Formatter &formatter, double ns)
+{
+    if(ns < 1000)
+        return formatter.Format("%? ns", Formatter::Significant(ns, 3));
+    return formatter.Format("%?", Formatter::Dur(static_cast<int64_t>(ns + 0.5)));
+}
+
+bool Selected(const Options &options, const char *name)
+{
+    if(options.workloads.empty())
+        return true;
+    for(const std::string &workload : options.workloads)
+    {
+        if(workload==name)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+    Formatter formatter;
+    std::printf("%s\n", formatter.Format("C++ %?, numbers are converted via %?", static_cast<long>(__cplusplus),
+            FORMAT_UTIL_TO_CHARS ? "std::to_chars" : "the built-in code and snprintf").c_str());
+    PerfCounters counters;
+    if(!counters.Good())
+        std::fprintf(stderr, "formatter-bench: hardware counters are not available, only time is reported\n");
+    // The checksum keeps the output of the workloads alive
+    static volatile uint64_t checksum = 0;
+    size_t selected = 0;
+    for(const Workload &workload : WORKLOADS)
+    {
+        if(!Selected(options, workload.name))
+            continue;
+        ++selected;
+        // The warm-up is measured too, so a group which cannot run is reduced before the measurement
+        counters.Start();
+        checksum = checksum + workload.run(options.calls / 10 + 1);
+        counters.Stop();
+        counters.Start();
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        checksum = checksum + workload.run(options.calls);
+        const std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+        counters.Stop();
+        const double ns = std::chrono::duration<double, std::nano>(stop - start).count() / options.calls;
+        std::printf("%s\n", formatter.Format("%?: %? per call", workload.name, PerCall(formatter, ns)).c_str());
+        if(counters.Good())
+            std::printf("%s\n", counters.Report(workload.name, options.calls).c_str());
+    }
+    if(selected==0)
+    {
+        std::fprintf(stderr, "formatter-bench: no such workload\n");
+        return 2;
+    }
+    return 0;
+}
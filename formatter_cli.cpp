@@ -0,0 +1,420 @@
+// formatter-cli: renders a template for each row of a TSV/CSV file (POSIX).
+//
+// Build:
+//     g++ -std=c++11 -O2 -pthread formatter_cli.cpp -o formatter-cli
+// Usage:
+//     formatter-cli [options] TEMPLATE INPUT
+// Each '%?' of the template is replaced by the next field of the row, a new line is added after each row.
+// Escapes '\n', '\t' and '\\' are allowed in the template.
+// Example:
+//     formatter-cli --csv -H "INSERT INTO users VALUES (%?, '%?');" users.csv > users.sql
+//
+// The input file is memory-mapped and split into line-aligned chunks, which are rendered by several threads
+// into their own buffers; the buffers are written in the order of the chunks.
+// Fields are not copied: they point into the mapped file (except quoted CSV fields with escaped quotes).
+// Quoted CSV fields must not contain line breaks. Input which is not a regular file (for example, a pipe) is read into memory.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "format_util.h"
+
+namespace
+{
+
+struct Options
+{
+    char delimiter = '\t';
+    bool quotes = false; // CSV quoting
+    bool skip_header = false;
+    bool new_line = true;
+    unsigned threads = 0;
+    size_t chunk_size = 4 * 1024 * 1024;
+    const char *output = nullptr;
+    std::string tmpl;
+    const char *input = nullptr;
+};
+
+void PrintUsage()
+{
+    std::fprintf(stderr,
+        "Usage: formatter-cli [options] TEMPLATE INPUT\n"
+        "Renders TEMPLATE for each row of INPUT: each '%%?' is replaced by the next field.\n"
+        "Options:\n"
+        "  --tsv          fields are separated by tabs (default)\n"
+        "  --csv          fields are separated by commas, quoted fields are supported\n"
+        "  -d CHAR        field delimiter\n"
+        "  -H             skip the header row\n"
+        "  -n             do not add a new line after each row\n"
+        "  -j N           number of threads (default: number of CPUs)\n"
+        "  -o FILE        output file (default: standard output)\n");
+}
+
+// Replaces escapes '\n', '\t' and '\\' in the template
+std::string Unescape(const char *text)
+{
+    std::string result;
+    for(; *text; ++text)
+    {
+        if(*text=='\\' && text[1])
+        {
+            ++text;
+            result += *text=='n' ? '\n' : (*text=='t' ? '\t' : *text);
+        }
+        else
+            result += *text;
+    }
+    return result;
+}
+
+bool ParseOptions(int argc, char **argv, Options &options)
+{
+    std::vector<const char*> positional;
+    for(int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg=="--tsv")
+        {
+            options.delimiter = '\t';
+            options.quotes = false;
+        }
+        else if(arg=="--csv")
+        {
+            options.delimiter = ',';
+            options.quotes = true;
+        }
+        else if(arg=="-d" && has_value && std::strlen(argv[i + 1])==1)
+            options.delimiter = argv[++i][0];
+        else if(arg=="-H")
+            options.skip_header = true;
+        else if(arg=="-n")
+            options.new_line = false;
+        else if(arg=="-j" && has_value)
+            options.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if(arg=="-o" && has_value)
+            options.output = argv[++i];
+        else if(arg.size() > 1 && arg[0]=='-')
+            return false;
+        else
+            positional.push_back(argv[i]);
+    }
+    if(positional.size()!=2)
+        return false;
+    options.tmpl = Unescape(positional[0]);
+    if(options.new_line)
+        options.tmpl += '\n';
+    options.input = positional[1];
+    if(options.threads==0)
+        options.threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    return true;
+}
+
+typedef FormatTemplate::Field Field;
+
+// Splits rows of a chunk into fields and renders them
+class RowRenderer
+{
+    public:
+        RowRenderer(const Options &options, const FormatTemplate &tmpl)
+           : m_options(options),
+             m_tmpl(tmpl)
+        { }
+
+        // Renders all rows of [first, last) into the output
+        void Render(const char *first, const char *last, std::string &output)
+        {
+            while(first < last)
+            {
+                const char *end = static_cast<const char*>(std::memchr(first, '\n', static_cast<size_t>(last - first)));
+                if(!end)
+                    end = last;
+                const char *row_end = (end > first && end[-1]=='\r') ? end - 1 : end;
+                if(m_options.quotes)
+                    SplitQuoted(first, row_end);
+                else
+                    Split(first, row_end);
+                m_formatter.FormatFieldsTo(output, m_tmpl, m_fields.data(), m_fields.size());
+                first = end + 1;
+            }
+        }
+
+    private:
+        const Options &m_options;
+        const FormatTemplate &m_tmpl;
+        Formatter m_formatter;
+        std::vector<Field> m_fields;
+        // Unescaped quoted fields of the current row
+        std::string m_unescaped;
+
+        void Split(const char *first, const char *last)
+        {
+            m_fields.clear();
+            for(;;)
+            {
+                const char *end = static_cast<const char*>(std::memchr(first, m_options.delimiter, static_cast<size_t>(last - first)));
+                if(!end)
+                    end = last;
+                m_fields.push_back(Field{first, static_cast<size_t>(end - first)});
+                if(end==last)
+                    break;
+                first = end + 1;
+            }
+        }
+
+        // Splits CSV row: a quoted field may contain delimiters and escaped quotes ("")
+        void SplitQuoted(const char *first, const char *last)
+        {
+            m_fields.clear();
+            m_unescaped.clear();
+            // Unescaped fields are never longer than the row, so the buffer is not reallocated while the row is split
+            m_unescaped.reserve(static_cast<size_t>(last - first));
+            for(;;)
+            {
+                const char *end;
+                if(first < last && *first=='"')
+                {
+                    const char *content = first + 1;
+                    const char *pos = content;
+                    bool escaped = false;
+                    while(pos < last && !(*pos=='"' && (pos + 1==last || pos[1]!='"')))
+                    {
+                        if(*pos=='"')
+                        {
+                            escaped = true;
+                            ++pos;
+                        }
+                        ++pos;
+                    }
+                    if(escaped)
+                    {
+                        const size_t start = m_unescaped.size();
+                        for(const char *c = content; c < pos; ++c)
+                        {
+                            m_unescaped += *c;
+                            if(*c=='"')
+                                ++c;
+                        }
+                        m_fields.push_back(Field{m_unescaped.data() + start, m_unescaped.size() - start});
+                    }
+                    else
+                        m_fields.push_back(Field{content, static_cast<size_t>(pos - content)});
+                    end = pos < last ? pos + 1 : last;
+                    // Skip characters after the closing quote up to the delimiter
+                    while(end < last && *end!=m_options.delimiter)
+                        ++end;
+                }
+                else
+                {
+                    end = static_cast<const char*>(std::memchr(first, m_options.delimiter, static_cast<size_t>(last - first)));
+                    if(!end)
+                        end = last;
+                    m_fields.push_back(Field{first, static_cast<size_t>(end - first)});
+                }
+                if(end==last)
+                    break;
+                first = end + 1;
+            }
+        }
+};
+
+// Chunks of the input rendered by worker threads and written in order
+class ChunkQueue
+{
+    public:
+        ChunkQueue(std::vector<const char*> bounds, size_t window)
+           : m_bounds(std::move(bounds)),
+             m_outputs(m_bounds.size() - 1),
+             m_ready(m_bounds.size() - 1, false),
+             m_next(0),
+             m_written(0),
+             m_window(window)
+        { }
+
+        size_t Count() const
+        {
+            return m_outputs.size();
+        }
+
+        // Worker: takes the next chunk (waits while too many chunks are not written yet)
+        // Returns false when there are no more chunks
+        bool Take(size_t &index, const char* &first, const char* &last, std::string &output)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_next==m_outputs.size())
+                return false;
+            index = m_next++;
+            m_writable.wait(lock, [&] { return index < m_written + m_window; });
+            first = m_bounds[index];
+            last = m_bounds[index + 1];
+            output.swap(m_outputs[index]);
+            return true;
+        }
+
+        // Worker: passes the rendered chunk to the writer
+        void Complete(size_t index, std::string &output)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_outputs[index].swap(output);
+                m_ready[index] = true;
+            }
+            m_readable.notify_all();
+        }
+
+        // Writer: writes the chunks in order
+        void WriteAll(Formatter::FdSink &sink)
+        {
+            std::string output;
+            for(size_t index = 0; index < m_outputs.size(); ++index)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_readable.wait(lock, [&] { return m_ready[index]; });
+                    output.swap(m_outputs[index]);
+                }
+                sink.Append(output.data(), output.size());
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    // The buffer is passed to a chunk which is not taken yet, its memory is reused
+                    output.clear();
+                    if(index + m_window < m_outputs.size())
+                        m_outputs[index + m_window].swap(output);
+                    ++m_written;
+                }
+                m_writable.notify_all();
+            }
+        }
+
+    private:
+        std::vector<const char*> m_bounds;
+        std::vector<std::string> m_outputs;
+        std::vector<bool> m_ready;
+        size_t m_next;
+        size_t m_written;
+        const size_t m_window;
+        std::mutex m_mutex;
+        std::condition_variable m_writable;
+        std::condition_variable m_readable;
+};
+
+// Splits [first, last) into chunks of about 'chunk_size' bytes, each chunk ends after a new line
+std::vector<const char*> SplitChunks(const char *first, const char *last, size_t chunk_size)
+{
+    std::vector<const char*> bounds(1, first);
+    while(static_cast<size_t>(last - bounds.back()) > chunk_size)
+    {
+        const char *pos = bounds.back() + chunk_size;
+        const char *end = static_cast<const char*>(std::memchr(pos, '\n', static_cast<size_t>(last - pos)));
+        if(!end || end + 1==last)
+            break;
+        bounds.push_back(end + 1);
+    }
+    if(bounds.back() < last || bounds.size()==1)
+        bounds.push_back(last);
+    return bounds;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+    const int input = open(options.input, O_RDONLY);
+    struct stat st;
+    if(input < 0 || fstat(input, &st)!=0)
+    {
+        std::fprintf(stderr, "formatter-cli: cannot open '%s': %s\n", options.input, std::strerror(errno));
+        return 1;
+    }
+    const int output = options.output ? open(options.output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if(output < 0)
+    {
+        std::fprintf(stderr, "formatter-cli: cannot open '%s': %s\n", options.output, std::strerror(errno));
+        return 1;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    const char *data = nullptr;
+    std::string piped; // Input which cannot be mapped (pipe, terminal) is read into memory
+    if(!S_ISREG(st.st_mode))
+    {
+        char buffer[64 * 1024];
+        ssize_t count;
+        while((count = read(input, buffer, sizeof(buffer))) > 0 || (count < 0 && errno==EINTR))
+        {
+            if(count > 0)
+                piped.append(buffer, static_cast<size_t>(count));
+        }
+        data = piped.data();
+        size = piped.size();
+    }
+    else if(size > 0)
+    {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, input, 0);
+        if(mapping==MAP_FAILED)
+        {
+            std::fprintf(stderr, "formatter-cli: cannot map '%s': %s\n", options.input, std::strerror(errno));
+            return 1;
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapping);
+    }
+    const char *first = data;
+    const char *last = data + size;
+    if(options.skip_header && first < last)
+    {
+        const char *end = static_cast<const char*>(std::memchr(first, '\n', size));
+        first = end ? end + 1 : last;
+    }
+
+    Formatter formatter;
+    const FormatTemplate tmpl = formatter.Compile(options.tmpl);
+    ChunkQueue queue(SplitChunks(first, last, options.chunk_size), 2 * options.threads);
+    std::vector<std::thread> workers;
+    const size_t threads = std::min<size_t>(options.threads, queue.Count());
+    for(size_t i = 0; i < threads; ++i)
+    {
+        workers.push_back(std::thread([&] {
+            RowRenderer renderer(options, tmpl);
+            std::string buffer;
+            size_t index;
+            const char *chunk_first;
+            const char *chunk_last;
+            while(queue.Take(index, chunk_first, chunk_last, buffer))
+            {
+                renderer.Render(chunk_first, chunk_last, buffer);
+                queue.Complete(index, buffer);
+            }
+        }));
+    }
+    Formatter::FdSink sink(output, 1024 * 1024);
+    queue.WriteAll(sink);
+    for(std::thread &worker : workers)
+        worker.join();
+    const bool good = sink.Flush();
+    if(data && piped.empty())
+        munmap(const_cast<char*>(data), size);
+    close(input);
+    if(options.output && close(output)!=0)
+        return 1;
+    if(!good)
+    {
+        std::fprintf(stderr, "formatter-cli: write error: %s\n", std::strerror(errno));
+        return 1;
+    }
+    return 0;
+}
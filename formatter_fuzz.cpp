@@ -0,0 +1,1305 @@
+// formatter-fuzz: randomised differential check of the formatter against a reference built on streams only
+// (POSIX, GCC or Clang).
+//
+// Build:
+//     g++ -std=c++17 -O2 -pthread -DFORMAT_UTIL_VERIFY=1 -DFORMAT_UTIL_JIT formatter_fuzz.cpp -o formatter-fuzz
+// Build with -std=c++11 or -DFORMAT_UTIL_TO_CHARS=0 to check the built-in number conversion instead of std::to_chars.
+// Usage:
+//     formatter-fuzz [options]
+// Each case is generated from its own seed: a template of literal text, '%?' and screened '%%?',
+// random flags, precision and locale, and from 0 to 5 arguments of a random type (numbers, strings,
+// containers) mixed with integers or strings, so the template gets missing, odd and extra arguments.
+// Narrow and wide characters are used.
+// The output of each path of the formatter is compared with the reference, which outputs each argument
+// into its own stream and substitutes the values as the original stream-based formatter did:
+// Format of the sequence and of the compiled template, FormatTo into strings, vectors and counting sinks,
+// FormatHash, FormatEquals, FormatFieldsTo and HotTemplate (native code with FORMAT_UTIL_JIT).
+// With style markup inserted at random places, the plain template of CompileStyled is compared with
+// the coloured one without its escape sequences.
+// Proxy arguments are compared with independent computations: Decimal with exact string arithmetic,
+// IPv4 and IPv6 with inet_ntop, Mac and Uuid with snprintf, Bytes, Si and Dur with exact decimal string arithmetic,
+// Significant with the stream. Tuples, smart pointers (also to void), optional and variant values are checked as well.
+// With FORMAT_UTIL_VERIFY=1 the numbers converted without the stream are also checked by the formatter itself.
+// The corpus file is replayed first: lines 'seed N' repeat the generated case N, lines recorded by
+// FORMAT_UTIL_VERIFY ("float value V, flags 0x..., precision P, locale 'L': ...") repeat the conversion of
+// the number with the recorded settings. Failing cases are appended to the corpus as 'seed N: description'.
+// With FORMAT_UTIL_VERIFY_CORPUS defined as a file name (-DFORMAT_UTIL_VERIFY_CORPUS='"fuzz-corpus.txt"')
+// the file is the default corpus, so the mismatches found by the formatter itself are replayed as well.
+// Example:
+//     formatter-fuzz -n 1000000 -c fuzz-corpus.txt
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <locale>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <arpa/inet.h>
+#include "format_util.h"
+#include "format_util_jit.h"
+
+namespace
+{
+
+struct Options
+{
+    uint64_t cases = 100000;
+    uint64_t seed = 0;
+    bool seed_given = false;
+#ifdef FORMAT_UTIL_VERIFY_CORPUS
+    const char *corpus = FORMAT_UTIL_VERIFY_CORPUS;
+#else
+    const char *corpus = nullptr;
+#endif
+};
+
+void PrintUsage()
+{
+    std::fprintf(stderr,
+        "Usage: formatter-fuzz [options]\n"
+        "Options:\n"
+        "  -n COUNT   number of random cases (default 100000)\n"
+        "  -s SEED    seed of the random cases (default: taken from the clock)\n"
+        "  -c FILE    corpus: its cases are replayed first, failing cases are appended\n"
+        "             (default FORMAT_UTIL_VERIFY_CORPUS if it is defined)\n");
+}
+
+bool ParseOptions(int argc, char **argv, Options &options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if(std::strcmp(arg, "-n")==0 && i + 1 < argc)
+            options.cases = std::strtoull(argv[++i], nullptr, 10);
+        else if(std::strcmp(arg, "-s")==0 && i + 1 < argc)
+        {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+            options.seed_given = true;
+        }
+        else if(std::strcmp(arg, "-c")==0 && i + 1 < argc)
+            options.corpus = argv[++i];
+        else
+            return false;
+    }
+    return true;
+}
+
+typedef std::mt19937_64 Random;
+
+// Returns random number in [0, n)
+size_t Uniform(Random &random, size_t n)
+{
+    return static_cast<size_t>(random() % n);
+}
+
+template<typename T>
+std::basic_string<T> Widen(const std::string &text)
+{
+    std::basic_string<T> result;
+    for(char c : text)
+        result += static_cast<T>(static_cast<unsigned char>(c));
+    return result;
+}
+
+// Text for the reports: characters out of printable ASCII are escaped
+template<typename T>
+std::string Printable(const std::basic_string<T> &text)
+{
+    std::string result;
+    for(T c : text)
+    {
+        const unsigned long code = static_cast<unsigned long>(static_cast<typename std::make_unsigned<T>::type>(c));
+        if(code >= 0x20 && code < 0x7F && c!=static_cast<T>('\\'))
+            result += static_cast<char>(code);
+        else
+        {
+            char escape[16];
+            std::snprintf(escape, sizeof(escape), "\\x{%lx}", code);
+            result += escape;
+        }
+    }
+    return result;
+}
+
+// Numeric punctuation for locales without names (the formatter converts numbers via the stream for them)
+template<typename T>
+class Punct : public std::numpunct<T>
+{
+    public:
+        Punct(char point, char separator, const char *grouping)
+            : m_point(static_cast<T>(point)), m_separator(static_cast<T>(separator)), m_grouping(grouping)
+        { }
+
+    protected:
+        T do_decimal_point() const override
+        {
+            return m_point;
+        }
+
+        T do_thousands_sep() const override
+        {
+            return m_separator;
+        }
+
+        std::string do_grouping() const override
+        {
+            return m_grouping;
+        }
+
+    private:
+        T m_point;
+        T m_separator;
+        std::string m_grouping;
+};
+
+std::locale PunctLocale(char point, char separator, const char *grouping)
+{
+    const std::locale narrow(std::locale::classic(), new Punct<char>(point, separator, grouping));
+    return std::locale(narrow, new Punct<wchar_t>(point, separator, grouping));
+}
+
+// Locales of the cases: the classic one (numbers are converted directly), locales with grouping,
+// another decimal point and the named locales which are installed
+std::vector<std::locale> CaseLocales()
+{
+    std::vector<std::locale> locales(1, std::locale::classic());
+    locales.push_back(PunctLocale('.', ',', "\3"));
+    locales.push_back(PunctLocale(',', '.', "\3"));
+    locales.push_back(PunctLocale(',', ' ', "\2\3"));
+    locales.push_back(PunctLocale(',', ' ', ""));
+    for(const char *name : {"C.UTF-8", "en_US.UTF-8", "de_DE.UTF-8", "ru_RU.UTF-8"})
+    {
+        try
+        {
+            locales.push_back(std::locale(name));
+        }
+        catch(const std::runtime_error&)
+        { }
+    }
+    return locales;
+}
+
+// Flags, precision and locale of a case, the same for the formatter and for the reference streams
+struct Settings
+{
+    std::ios_base::fmtflags flags;
+    std::streamsize precision;
+    std::locale locale;
+};
+
+Settings RandomSettings(Random &random, const std::vector<std::locale> &locales)
+{
+    static const std::ios_base::fmtflags basefields[] = {std::ios_base::fmtflags(), std::ios_base::dec,
+                                                         std::ios_base::hex, std::ios_base::oct};
+    static const std::ios_base::fmtflags floatfields[] = {std::ios_base::fmtflags(), std::ios_base::fixed,
+                                                          std::ios_base::scientific,
+                                                          std::ios_base::fixed | std::ios_base::scientific};
+    static const std::ios_base::fmtflags bits[] = {std::ios_base::showpos, std::ios_base::showpoint,
+                                                   std::ios_base::showbase, std::ios_base::uppercase,
+                                                   std::ios_base::boolalpha, std::ios_base::left};
+    Settings settings;
+    // Most cases use the default settings, which allow the direct conversion of numbers
+    if(Uniform(random, 3)==0)
+    {
+        settings.flags = std::ios_base::dec | std::ios_base::skipws;
+        settings.precision = 6;
+        settings.locale = std::locale::classic();
+        return settings;
+    }
+    settings.flags = basefields[Uniform(random, 4)] | floatfields[Uniform(random, 4)];
+    for(std::ios_base::fmtflags bit : bits)
+    {
+        if(Uniform(random, 4)==0)
+            settings.flags |= bit;
+    }
+    static const std::streamsize precisions[] = {6, 0, 1, 3, 9, 15, 16, 17, 20, 40};
+    settings.precision = Uniform(random, 2)==0 ? precisions[Uniform(random, 10)]
+                                               : static_cast<std::streamsize>(Uniform(random, 25));
+    settings.locale = Uniform(random, 2)==0 ? locales[0] : locales[Uniform(random, locales.size())];
+    return settings;
+}
+
+void Apply(Formatter &formatter, const Settings &settings)
+{
+    formatter.Flags(settings.flags);
+    formatter.Precision(settings.precision);
+    formatter.Imbue(settings.locale);
+}
+
+// Non-ASCII text of the character type
+std::string NonAscii(char)
+{
+    return "\xc3\xa9\xe4\xb8\xad";
+}
+
+std::wstring NonAscii(wchar_t)
+{
+    return L"é中";
+}
+
+// Random text with the characters of format specifiers
+template<typename T>
+std::basic_string<T> RandomText(Random &random, size_t max_size)
+{
+    static const char alphabet[] = "abcXYZ 019,.:%?";
+    std::basic_string<T> text;
+    const size_t size = Uniform(random, max_size + 1);
+    for(size_t i = 0; i < size; ++i)
+    {
+        if(Uniform(random, 16)==0)
+            text += NonAscii(T());
+        else
+            text += static_cast<T>(alphabet[Uniform(random, sizeof(alphabet) - 1)]);
+    }
+    return text;
+}
+
+// Random template of literal text, specifiers, screened specifiers and stray '%' and '?'
+template<typename T>
+std::basic_string<T> RandomTemplate(Random &random)
+{
+    static const char* const pieces[] = {"%?", "%?", "%?", "%%?", "%%%?", "%", "?", "%?%?", "?%", "%%"};
+    std::basic_string<T> seq;
+    const size_t count = Uniform(random, 9);
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(Uniform(random, 2)==0)
+            seq += RandomText<T>(random, 6);
+        else
+            seq += Widen<T>(pieces[Uniform(random, sizeof(pieces) / sizeof(pieces[0]))]);
+    }
+    return seq;
+}
+
+// Random values of the argument types
+
+int64_t RandomInteger(Random &random)
+{
+    static const int64_t special[] = {0, 1, -1, 9, 10, 99, 100, 999, 1000, 1000000,
+                                      std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max(),
+                                      std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()};
+    switch(Uniform(random, 4))
+    {
+        case 0:
+            return static_cast<int64_t>(Uniform(random, 2001)) - 1000;
+        case 1:
+            return special[Uniform(random, sizeof(special) / sizeof(special[0]))];
+        case 2:
+            // Any number of digits
+            return static_cast<int64_t>(random() >> Uniform(random, 64));
+        default:
+            return static_cast<int64_t>(random());
+    }
+}
+
+double RandomDouble(Random &random)
+{
+    static const double special[] = {0.0, -0.0, 0.5, 1.0, -1.0, 0.1, 1e-5, 1e-4, 1e15, 1e16, 1e17, 1e21, 1e22,
+                                     std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                                     std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+                                     std::numeric_limits<double>::min(), std::numeric_limits<double>::denorm_min(),
+                                     std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest(),
+                                     std::numeric_limits<double>::epsilon()};
+    switch(Uniform(random, 7))
+    {
+        case 0:
+            return static_cast<double>(static_cast<int64_t>(Uniform(random, 2001)) - 1000);
+        case 1:
+            // Amounts with two decimals
+            return static_cast<double>(static_cast<int64_t>(Uniform(random, 2000001)) - 1000000) / 100;
+        case 2:
+            return special[Uniform(random, sizeof(special) / sizeof(special[0]))];
+        case 3:
+        {
+            // Around powers of ten, where the number of digits and the notation change
+            const double power = std::pow(10.0, static_cast<double>(static_cast<int>(Uniform(random, 61)) - 30));
+            const double direction = Uniform(random, 2)==0 ? 0.0 : std::numeric_limits<double>::infinity();
+            return Uniform(random, 3)==0 ? power : std::nextafter(power, direction);
+        }
+        case 4:
+            return std::uniform_real_distribution<double>(-1e6, 1e6)(random);
+        default:
+        {
+            const uint64_t bits = random();
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+    }
+}
+
+float RandomFloat(Random &random)
+{
+    if(Uniform(random, 2)==0)
+        return static_cast<float>(RandomDouble(random));
+    const uint32_t bits = static_cast<uint32_t>(random());
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void Generate(Random &random, int &value)
+{
+    value = static_cast<int>(RandomInteger(random));
+}
+
+void Generate(Random &random, long long &value)
+{
+    value = static_cast<long long>(RandomInteger(random));
+}
+
+void Generate(Random &random, unsigned long long &value)
+{
+    value = static_cast<unsigned long long>(RandomInteger(random));
+}
+
+void Generate(Random &random, double &value)
+{
+    value = RandomDouble(random);
+}
+
+void Generate(Random &random, float &value)
+{
+    value = RandomFloat(random);
+}
+
+void Generate(Random &random, bool &value)
+{
+    value = Uniform(random, 2)==0;
+}
+
+template<typename T>
+void Generate(Random &random, std::basic_string<T> &value)
+{
+    value = RandomText<T>(random, 12);
+}
+
+template<typename V>
+void Generate(Random &random, std::vector<V> &value)
+{
+    value.resize(Uniform(random, 5));
+    for(V &element : value)
+        Generate(random, element);
+}
+
+template<typename K, typename V>
+void Generate(Random &random, std::map<K, V> &value)
+{
+    value.clear();
+    const size_t count = Uniform(random, 4);
+    for(size_t i = 0; i < count; ++i)
+    {
+        K key;
+        Generate(random, key);
+        Generate(random, value[key]);
+    }
+}
+
+// Reference output of the values: each value is output into its own stream with the settings of the case,
+// in the same way as the original formatter did (containers as '[a, b]', pairs and tuples in braces,
+// booleans as 'true' and 'false', empty smart pointers and optional values as 'null')
+template<typename T>
+class Reference
+{
+    public:
+        typedef std::basic_string<T> String;
+        typedef std::basic_ostringstream<T> Stream;
+
+        explicit Reference(const Settings &settings)
+            : m_settings(settings)
+        { }
+
+        template<typename V>
+        String Text(const V &value) const
+        {
+            Stream stream;
+            stream.flags(m_settings.flags);
+            stream.precision(m_settings.precision);
+            stream.imbue(m_settings.locale);
+            Put(stream, value);
+            return stream.str();
+        }
+
+    private:
+        const Settings &m_settings;
+
+        template<typename V, typename = typename std::enable_if<std::is_arithmetic<V>::value>::type>
+        static void Put(Stream &stream, const V &value)
+        {
+            stream << value;
+        }
+
+        static void Put(Stream &stream, bool value)
+        {
+            stream << (value ? "true" : "false");
+        }
+
+        static void Put(Stream &stream, const T *text)
+        {
+            stream << text;
+        }
+
+        static void Put(Stream &stream, const String &text)
+        {
+            stream << text;
+        }
+
+        template<typename V>
+        static void Put(Stream &stream, const std::vector<V> &value)
+        {
+            PutRange(stream, value);
+        }
+
+        template<typename K, typename V>
+        static void Put(Stream &stream, const std::map<K, V> &value)
+        {
+            PutRange(stream, value);
+        }
+
+        template<typename Container>
+        static void PutRange(Stream &stream, const Container &value)
+        {
+            stream << "[";
+            bool first = true;
+            for(const auto &element : value)
+            {
+                if(!first)
+                    stream << ", ";
+                first = false;
+                Put(stream, element);
+            }
+            stream << "]";
+        }
+
+        template<typename K, typename V>
+        static void Put(Stream &stream, const std::pair<K, V> &value)
+        {
+            stream << "{";
+            Put(stream, value.first);
+            stream << " : ";
+            Put(stream, value.second);
+            stream << "}";
+        }
+
+        template<typename A, typename B, typename C>
+        static void Put(Stream &stream, const std::tuple<A, B, C> &value)
+        {
+            stream << "{";
+            Put(stream, std::get<0>(value));
+            stream << ", ";
+            Put(stream, std::get<1>(value));
+            stream << ", ";
+            Put(stream, std::get<2>(value));
+            stream << "}";
+        }
+
+        template<typename V>
+        static void Put(Stream &stream, const std::unique_ptr<V> &value)
+        {
+            if(value)
+                Put(stream, *value);
+            else
+                stream << "null";
+        }
+
+        template<typename V>
+        static void Put(Stream &stream, const std::shared_ptr<V> &value)
+        {
+            if(value)
+                Put(stream, *value);
+            else
+                stream << "null";
+        }
+
+        // Pointers to void cannot be dereferenced, they are output as addresses
+        static void Put(Stream &stream, const std::shared_ptr<void> &value)
+        {
+            stream << static_cast<const void*>(value.get());
+        }
+
+        template<typename D>
+        static void Put(Stream &stream, const std::unique_ptr<void, D> &value)
+        {
+            stream << static_cast<const void*>(value.get());
+        }
+
+#if FORMAT_UTIL_CPP17
+        template<typename V>
+        static void Put(Stream &stream, const std::optional<V> &value)
+        {
+            if(value)
+                Put(stream, *value);
+            else
+                stream << "null";
+        }
+
+        static void Put(Stream &stream, std::monostate)
+        {
+            stream << "null";
+        }
+
+        template<typename... Types>
+        static void Put(Stream &stream, const std::variant<Types...> &value)
+        {
+            std::visit([&stream](const auto &alternative) { Put(stream, alternative); }, value);
+        }
+#endif
+};
+
+// Substitutes the values as the original stream-based formatter did: screened '%%?' is output as '%?',
+// missing values as '?', odd values are ignored and without values the sequence is output as is
+template<typename T>
+std::basic_string<T> ReferenceFormat(const std::basic_string<T> &seq, const std::vector<std::basic_string<T>> &values)
+{
+    if(values.empty())
+        return seq;
+    const std::basic_string<T> mask = Widen<T>("%?");
+    std::basic_ostringstream<T> stream;
+    size_t pos;
+    size_t last = 0;
+    size_t index = 0;
+    while((pos = seq.find(mask, last))!=std::basic_string<T>::npos)
+    {
+        if(pos > 0 && seq[pos - 1]==static_cast<T>('%'))
+        {
+            stream << seq.substr(last, pos - last - 1) << mask;
+            last = pos + mask.size();
+            continue;
+        }
+        stream << seq.substr(last, pos - last);
+        if(index < values.size())
+            stream << values[index++];
+        else
+            stream << static_cast<T>('?');
+        last = pos + mask.size();
+    }
+    stream << seq.substr(last);
+    return stream.str();
+}
+
+// Decimal point of the locale
+template<typename T>
+T DecimalPoint(const std::locale &locale)
+{
+    return std::use_facet<std::numpunct<T>>(locale).decimal_point();
+}
+
+// Reference of Decimal: the digits of the exact value are split by string operations,
+// the whole part is grouped by the stream
+template<typename T>
+std::basic_string<T> ReferenceDecimal(const Settings &settings, int64_t value, unsigned scale)
+{
+    const uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    std::string digits = std::to_string(magnitude);
+    if(digits.size() <= scale)
+        digits.insert(0, scale + 1 - digits.size(), '0');
+    const std::string whole = digits.substr(0, digits.size() - scale);
+    std::basic_ostringstream<T> stream;
+    stream.imbue(settings.locale);
+    if(value < 0)
+        stream << '-';
+    else if(settings.flags & std::ios_base::showpos)
+        stream << '+';
+    stream << std::strtoull(whole.c_str(), nullptr, 10);
+    if(scale > 0 || (settings.flags & std::ios_base::showpoint))
+        stream << DecimalPoint<T>(settings.locale) << Widen<T>(digits.substr(digits.size() - scale));
+    return stream.str();
+}
+
+// Exact decimal digits of magnitude / base^unit (base is 1000 or 1024):
+// the division by 1024 is the multiplication by 5^10 and the shift of the decimal point by 10 digits.
+// Returns the digits with at least one whole digit, 'fraction' is the number of fraction digits
+std::string DivideDecimal(uint64_t magnitude, unsigned base, size_t unit, size_t &fraction)
+{
+    std::string digits = std::to_string(magnitude);
+    fraction = (base==1024 ? 10 : 3) * unit;
+    if(base==1024)
+    {
+        for(size_t i = 0; i < 10 * unit; ++i)
+        {
+            unsigned carry = 0;
+            for(size_t j = digits.size(); j-- > 0; )
+            {
+                const unsigned product = static_cast<unsigned>(digits[j] - '0') * 5 + carry;
+                digits[j] = static_cast<char>('0' + product % 10);
+                carry = product / 10;
+            }
+            if(carry > 0)
+                digits.insert(digits.begin(), static_cast<char>('0' + carry));
+        }
+    }
+    if(digits.size() <= fraction)
+        digits.insert(0, fraction + 1 - digits.size(), '0');
+    return digits;
+}
+
+// Reference of Bytes, Si and Dur: the first unit where the value rounded half up to 3 significant digits
+// (whole digits are kept) is less than 1000, computed by exact decimal string arithmetic
+template<typename T>
+std::basic_string<T> ReferenceUnits(const Settings &settings, bool negative, uint64_t magnitude, unsigned base,
+                                    const char* const *units, size_t units_count)
+{
+    size_t unit = 0;
+    std::string digits;
+    unsigned decimals = 0;
+    for(; unit < units_count; ++unit)
+    {
+        size_t fraction;
+        const std::string exact = DivideDecimal(magnitude, base, unit, fraction);
+        const size_t first = exact.find_first_not_of('0');
+        const size_t whole_size = exact.size() - fraction;
+        // Decimal exponent of the value
+        const long exponent = first==std::string::npos ? 0 : static_cast<long>(whole_size) - 1 - static_cast<long>(first);
+        decimals = unit==0 || exponent >= 2 ? 0 : static_cast<unsigned>(2 - exponent);
+        // Rounding half up to the decimals
+        digits = exact.substr(0, whole_size + decimals);
+        if(whole_size + decimals < exact.size() && exact[whole_size + decimals] >= '5')
+        {
+            size_t i = digits.size();
+            for(; i-- > 0 && digits[i]=='9'; )
+                digits[i] = '0';
+            if(i==std::string::npos)
+                digits.insert(digits.begin(), '1');
+            else
+                ++digits[i];
+        }
+        const size_t significant = digits.find_first_not_of('0');
+        const size_t whole_digits = significant==std::string::npos || significant >= digits.size() - decimals ?
+                0 : digits.size() - decimals - significant;
+        if(whole_digits <= 3 || unit + 1==units_count)
+            break;
+    }
+    digits.erase(0, std::min(digits.find_first_not_of('0'), digits.size() - decimals - 1));
+    for(; decimals > 0 && digits.back()=='0'; --decimals)
+        digits.pop_back();
+    std::basic_string<T> result;
+    if(negative)
+        result += static_cast<T>('-');
+    result += Widen<T>(digits.substr(0, digits.size() - decimals));
+    if(decimals > 0)
+        result += DecimalPoint<T>(settings.locale) + Widen<T>(digits.substr(digits.size() - decimals));
+    return result + Widen<T>(units[unit]);
+}
+
+// Deleter of the memory allocated by malloc (for smart pointers to void)
+struct FreeDeleter
+{
+    void operator()(void *ptr) const
+    {
+        std::free(ptr);
+    }
+};
+
+// Kinds of the arguments of the generated cases
+enum class Kind
+{
+    INT,
+    LONG_LONG,
+    UNSIGNED_LONG_LONG,
+    DOUBLE,
+    FLOAT,
+    BOOL,
+    STRING,
+    C_STRING,
+    VECTOR,
+    MAP,
+    KINDS
+};
+
+// Generated case: arguments of the first kind are at even positions, of the second kind at odd ones
+// (the same kind, long long or string)
+template<typename T>
+struct Case
+{
+    std::string label;
+    Settings settings;
+    std::basic_string<T> seq;
+    size_t count;
+    Kind first;
+    Kind second;
+};
+
+class Report;
+
+// Differential check of the outputs of one character type
+template<typename T>
+class Checker
+{
+    public:
+        typedef std::basic_string<T> String;
+
+        Checker(Report &report, const std::vector<std::locale> &locales)
+            : m_report(report), m_locales(locales)
+        { }
+
+        // Checks the case generated from the random state
+        void Run(const std::string &label, Random &random)
+        {
+            Case<T> c;
+            c.label = label;
+            c.settings = RandomSettings(random, m_locales);
+            c.seq = RandomTemplate<T>(random);
+            c.count = Uniform(random, 6);
+            c.first = static_cast<Kind>(Uniform(random, static_cast<size_t>(Kind::KINDS)));
+            static const Kind partners[] = {Kind::LONG_LONG, Kind::STRING};
+            c.second = Uniform(random, 3)==0 ? c.first : partners[Uniform(random, 2)];
+            std::deque<String> texts;
+            switch(c.first)
+            {
+                case Kind::INT: WithFirst(c, random, Arguments<int>(random, texts)); break;
+                case Kind::LONG_LONG: WithFirst(c, random, Arguments<long long>(random, texts)); break;
+                case Kind::UNSIGNED_LONG_LONG: WithFirst(c, random, Arguments<unsigned long long>(random, texts)); break;
+                case Kind::DOUBLE: WithFirst(c, random, Arguments<double>(random, texts)); break;
+                case Kind::FLOAT: WithFirst(c, random, Arguments<float>(random, texts)); break;
+                case Kind::BOOL: WithFirst(c, random, Arguments<bool>(random, texts)); break;
+                case Kind::STRING: WithFirst(c, random, Arguments<String>(random, texts)); break;
+                case Kind::C_STRING: WithFirst(c, random, Arguments<const T*>(random, texts)); break;
+                case Kind::VECTOR: WithFirst(c, random, Arguments<std::vector<double>>(random, texts)); break;
+                case Kind::MAP: WithFirst(c, random, Arguments<std::map<int, String>>(random, texts)); break;
+                case Kind::KINDS: break;
+            }
+            CheckProxies(c, random);
+            CheckCompounds(c, random);
+        }
+
+        // Checks the conversion of the number with the settings recorded in the corpus
+        template<typename V>
+        void CheckNumber(const std::string &label, const Settings &settings, V value)
+        {
+            Case<T> c;
+            c.label = label;
+            c.settings = settings;
+            c.seq = Widen<T>("%?");
+            Check(c, value);
+        }
+
+    private:
+        Report &m_report;
+        const std::vector<std::locale> &m_locales;
+
+        // Three values of the kind (C-strings point into 'texts'), a deque holds booleans as they are
+        template<typename V>
+        std::deque<V> Arguments(Random &random, std::deque<String> &texts)
+        {
+            std::deque<V> values(3);
+            for(V &value : values)
+                GenerateArgument(random, texts, value);
+            return values;
+        }
+
+        template<typename V>
+        static void GenerateArgument(Random &random, std::deque<String>&, V &value)
+        {
+            Generate(random, value);
+        }
+
+        static void GenerateArgument(Random &random, std::deque<String> &texts, const T *&value)
+        {
+            texts.push_back(String());
+            Generate(random, texts.back());
+            value = texts.back().c_str();
+        }
+
+        // Arguments of the first kind are mixed with the same kind, with integers or with strings
+        // (other pairs of kinds do not take other paths, they would only multiply the instantiations)
+        template<typename A>
+        void WithFirst(const Case<T> &c, Random &random, const std::deque<A> &first)
+        {
+            std::deque<String> texts;
+            if(c.second==c.first)
+                WithBoth(c, first, first);
+            else if(c.second==Kind::LONG_LONG)
+                WithBoth(c, first, Arguments<long long>(random, texts));
+            else
+                WithBoth(c, first, Arguments<String>(random, texts));
+        }
+
+        template<typename A, typename B>
+        void WithBoth(const Case<T> &c, const std::deque<A> &a, const std::deque<B> &b)
+        {
+            switch(c.count)
+            {
+                case 0: Check(c); break;
+                case 1: Check(c, a[0]); break;
+                case 2: Check(c, a[0], b[0]); break;
+                case 3: Check(c, a[0], b[0], a[1]); break;
+                case 4: Check(c, a[0], b[0], a[1], b[1]); break;
+                default: Check(c, a[0], b[0], a[1], b[1], a[2]); break;
+            }
+        }
+
+        // Compares all output paths of the formatter with the reference
+        template<typename... Args>
+        void Check(const Case<T> &c, const Args&... args)
+        {
+            const Reference<T> reference(c.settings);
+            const std::vector<String> values = {reference.Text(args)...};
+            const String expected = ReferenceFormat(c.seq, values);
+            Formatter formatter;
+            Apply(formatter, c.settings);
+            Compare(c, "Format", expected, formatter.Format(c.seq, args...));
+            Compare(c, "Format of C-string", expected, formatter.Format(c.seq.c_str(), args...));
+            const BasicFormatTemplate<T> tmpl = formatter.Compile(c.seq);
+            Compare(c, "Format of compiled template", expected, formatter.Format(tmpl, args...));
+            const String prefix = Widen<T>("prefix ");
+            String appended = prefix;
+            formatter.FormatTo(appended, c.seq, args...);
+            Compare(c, "FormatTo string", prefix + expected, appended);
+            std::vector<T> vector;
+            formatter.FormatTo(vector, tmpl, args...);
+            Compare(c, "FormatTo vector", expected, String(vector.begin(), vector.end()));
+            Formatter::CountingSink<T> counter;
+            formatter.FormatTo(counter, c.seq, args...);
+            Compare(c, "FormatTo counting sink", Widen<T>(std::to_string(expected.size())),
+                    Widen<T>(std::to_string(counter.Count())));
+            if(formatter.FormatHash(c.seq, args...)!=Formatter::Hash(expected))
+                Compare(c, "FormatHash", expected, Widen<T>("(different hash)"));
+            if(!formatter.FormatEquals(expected, c.seq.c_str(), args...))
+                Compare(c, "FormatEquals", expected, Widen<T>("(not equal)"));
+            CheckFields(c, formatter, tmpl, values);
+            CheckStyled(c, formatter, args...);
+        }
+
+        // Inserts style markup between the characters of the case: the plain template must output
+        // the same as the coloured one without its escape sequences, with the same arguments
+        template<typename... Args>
+        void CheckStyled(const Case<T> &random_case, Formatter &formatter, const Args&... args)
+        {
+            static const char* const markup[] = {"{bold}", "{/}", "{red,bg_blue}", "{/}", "%<green>?"};
+            Random random(std::hash<String>()(random_case.seq));
+            Case<T> c = random_case;
+            c.seq.clear();
+            for(T ch : random_case.seq)
+            {
+                if(Uniform(random, 3)==0)
+                    c.seq += Widen<T>(markup[Uniform(random, sizeof(markup) / sizeof(markup[0]))]);
+                c.seq += ch;
+            }
+            const BasicStyledTemplate<T> tmpl = formatter.CompileStyled(c.seq);
+            const String colored = formatter.Format(tmpl.Select(true), args...);
+            String unstyled;
+            for(size_t i = 0; i < colored.size(); ++i)
+            {
+                if(colored[i]==static_cast<T>('\x1B'))
+                    i = colored.find(static_cast<T>('m'), i);
+                else
+                    unstyled += colored[i];
+            }
+            Compare(c, "CompileStyled", unstyled, formatter.Format(tmpl.Select(false), args...));
+        }
+
+        // Compares the output of the template filled with the reference values as text fields
+        void CheckFields(const Case<T> &c, Formatter &formatter, const BasicFormatTemplate<T> &tmpl,
+                         const std::vector<String> &values)
+        {
+            std::vector<typename BasicFormatTemplate<T>::Field> fields;
+            for(const String &value : values)
+                fields.push_back({value.data(), value.size()});
+            const String expected = ReferenceFormat(c.seq, values);
+            String output;
+            formatter.FormatFieldsTo(output, tmpl, fields.data(), fields.size());
+            Compare(c, "FormatFieldsTo", expected, output);
+            CheckHot(c, formatter, tmpl, fields, expected);
+        }
+
+        // HotTemplate fills narrow templates only: it is called until the native code is used
+        void CheckHot(const Case<char> &c, Formatter &formatter, const FormatTemplate &tmpl,
+                      const std::vector<FormatTemplate::Field> &fields, const std::string &expected)
+        {
+            HotTemplate hot(tmpl, 1);
+            for(int i = 0; i < 3; ++i)
+            {
+                std::string output;
+                hot.FormatFieldsTo(formatter, output, fields.data(), fields.size());
+                Compare(c, hot.Native() ? "HotTemplate (native code)" : "HotTemplate", expected, output);
+            }
+        }
+
+        void CheckHot(const Case<wchar_t>&, Formatter&, const WFormatTemplate&,
+                      const std::vector<WFormatTemplate::Field>&, const std::wstring&)
+        { }
+
+        // Compares the proxy arguments with independent computations
+        void CheckProxies(const Case<T> &random_case, Random &random)
+        {
+            Formatter formatter;
+            Apply(formatter, random_case.settings);
+            const String seq = Widen<T>("<%?>");
+            Case<T> c = random_case;
+            c.seq = seq;
+            const String open = Widen<T>("<");
+            const String close = Widen<T>(">");
+
+            const int64_t value = RandomInteger(random);
+            const unsigned scale = Uniform(random, 8)==0 ? static_cast<unsigned>(Uniform(random, 45))
+                                                         : static_cast<unsigned>(Uniform(random, 7));
+            Compare(c, "Decimal", open + ReferenceDecimal<T>(c.settings, value, scale) + close,
+                    formatter.Format(seq, Formatter::Decimal(value, scale)));
+
+            unsigned char bytes[16];
+            RandomBytes(random, bytes);
+            char text[INET6_ADDRSTRLEN];
+            inet_ntop(AF_INET, bytes, text, sizeof(text));
+            Compare(c, "IPv4", open + Widen<T>(text) + close, formatter.Format(seq, Formatter::IPv4(bytes)));
+            inet_ntop(AF_INET6, bytes, text, sizeof(text));
+            Compare(c, "IPv6", open + Widen<T>(text) + close, formatter.Format(seq, Formatter::IPv6(bytes)));
+            char mac[32];
+            std::snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+                          bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5]);
+            Compare(c, "Mac", open + Widen<T>(mac) + close, formatter.Format(seq, Formatter::Mac(bytes)));
+            char uuid[40];
+            std::snprintf(uuid, sizeof(uuid), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                          bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7],
+                          bytes[8], bytes[9], bytes[10], bytes[11], bytes[12], bytes[13], bytes[14], bytes[15]);
+            Compare(c, "Uuid", open + Widen<T>(uuid) + close, formatter.Format(seq, Formatter::Uuid(bytes)));
+
+            static const char* const bytes_units[] = {" B", " KiB", " MiB", " GiB", " TiB", " PiB", " EiB"};
+            static const char* const si_units[] = {"", "k", "M", "G", "T", "P", "E"};
+            static const char* const duration_units[] = {" ns", " us", " ms", " s"};
+            const uint64_t size = RandomQuantity(random, 1024);
+            Compare(c, "Bytes", open + ReferenceUnits<T>(c.settings, false, size, 1024, bytes_units, 7) + close,
+                    formatter.Format(seq, Formatter::Bytes(size)));
+            const int64_t quantity = RandomSigned(random, RandomQuantity(random, 1000));
+            Compare(c, "Si", open + ReferenceUnits<T>(c.settings, quantity < 0, Magnitude(quantity), 1000,
+                                                      si_units, 7) + close,
+                    formatter.Format(seq, Formatter::Si(quantity)));
+            const int64_t duration = RandomSigned(random, RandomQuantity(random, 1000));
+            Compare(c, "Dur", open + ReferenceUnits<T>(c.settings, duration < 0, Magnitude(duration), 1000,
+                                                       duration_units, 4) + close,
+                    formatter.Format(seq, Formatter::Dur(duration)));
+
+            const double number = RandomDouble(random);
+            const int digits = static_cast<int>(Uniform(random, 22)) - 2;
+            std::ostringstream significant;
+            significant.precision(digits < 1 ? 1 : (digits > 17 ? 17 : digits));
+            significant << number;
+            String expected = Widen<T>(significant.str());
+            for(T &ch : expected)
+            {
+                if(ch==static_cast<T>('.'))
+                    ch = DecimalPoint<T>(c.settings.locale);
+            }
+            Compare(c, "Significant", open + expected + close, formatter.Format(seq, Formatter::Significant(number, digits)));
+
+            const uint64_t hex = static_cast<uint64_t>(RandomInteger(random));
+            std::ostringstream hex_text;
+            hex_text << std::hex << hex;
+            Compare(c, "Hex", open + Widen<T>(hex_text.str()) + close, formatter.Format(seq, Formatter::Hex(hex)));
+        }
+
+        // Compares tuples, pairs, smart pointers, optional and variant values
+        void CheckCompounds(const Case<T> &random_case, Random &random)
+        {
+            const Reference<T> reference(random_case.settings);
+            Formatter formatter;
+            Apply(formatter, random_case.settings);
+            const String seq = Widen<T>("%?");
+            Case<T> c = random_case;
+            c.seq = seq;
+
+            std::tuple<int, double, String> tuple;
+            Generate(random, std::get<0>(tuple));
+            Generate(random, std::get<1>(tuple));
+            Generate(random, std::get<2>(tuple));
+            Compare(c, "tuple", reference.Text(tuple), formatter.Format(seq, tuple));
+            std::pair<long long, std::vector<float>> pair;
+            Generate(random, pair.first);
+            Generate(random, pair.second);
+            Compare(c, "pair", reference.Text(pair), formatter.Format(seq, pair));
+
+            std::unique_ptr<double> unique;
+            if(Uniform(random, 3)!=0)
+                unique.reset(new double(RandomDouble(random)));
+            Compare(c, "unique_ptr", reference.Text(unique), formatter.Format(seq, unique));
+            std::shared_ptr<String> shared;
+            if(Uniform(random, 3)!=0)
+            {
+                shared = std::make_shared<String>();
+                Generate(random, *shared);
+            }
+            Compare(c, "shared_ptr", reference.Text(shared), formatter.Format(seq, shared));
+            std::shared_ptr<void> shared_void;
+            if(Uniform(random, 3)!=0)
+                shared_void = std::make_shared<int>(0);
+            Compare(c, "shared_ptr<void>", reference.Text(shared_void), formatter.Format(seq, shared_void));
+            std::unique_ptr<void, FreeDeleter> unique_void(Uniform(random, 3)!=0 ? std::malloc(1) : nullptr);
+            Compare(c, "unique_ptr<void>", reference.Text(unique_void), formatter.Format(seq, unique_void));
+
+#if FORMAT_UTIL_CPP17
+            std::optional<long long> optional;
+            if(Uniform(random, 3)!=0)
+                optional = RandomInteger(random);
+            Compare(c, "optional", reference.Text(optional), formatter.Format(seq, optional));
+            std::variant<int, double, String, std::monostate> variant;
+            switch(Uniform(random, 4))
+            {
+                case 0: variant = static_cast<int>(RandomInteger(random)); break;
+                case 1: variant = RandomDouble(random); break;
+                case 2: variant = RandomText<T>(random, 12); break;
+                default: variant = std::monostate(); break;
+            }
+            Compare(c, "variant", reference.Text(variant), formatter.Format(seq, variant));
+#endif
+        }
+
+        // Random address bytes: zero runs and IPv4-mapped addresses are frequent
+        static void RandomBytes(Random &random, unsigned char (&bytes)[16])
+        {
+            for(unsigned char &byte : bytes)
+                byte = Uniform(random, 3)==0 ? 0 : static_cast<unsigned char>(random());
+            if(Uniform(random, 8)==0)
+            {
+                std::memset(bytes, 0, 10);
+                bytes[10] = bytes[11] = 0xff;
+            }
+        }
+
+        // Random quantity, frequently at the boundaries of the units
+        static uint64_t RandomQuantity(Random &random, uint64_t base)
+        {
+            if(Uniform(random, 2)==0)
+                return random() >> Uniform(random, 64);
+            uint64_t next_unit = base;
+            for(size_t power = Uniform(random, 6); power > 0; --power)
+                next_unit *= base;
+            static const uint64_t parts[] = {1, 9995, 99950, 976500, 976563, 999500, 999949, 1000000, 1023500, 1023999};
+            const uint64_t part = parts[Uniform(random, sizeof(parts) / sizeof(parts[0]))];
+            // part / 1000000 of the next unit, around the rounding boundaries
+            const uint64_t quantity = next_unit / 1000000 * part + next_unit % 1000000 * part / 1000000;
+            return quantity + Uniform(random, 3) - 1;
+        }
+
+        static int64_t RandomSigned(Random &random, uint64_t magnitude)
+        {
+            const int64_t value = static_cast<int64_t>(magnitude >> 1);
+            return Uniform(random, 4)==0 ? -value - static_cast<int64_t>(Uniform(random, 2)) : value;
+        }
+
+        static uint64_t Magnitude(int64_t value)
+        {
+            return value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+        }
+
+        void Compare(const Case<T> &c, const char *path, const String &expected, const String &actual);
+};
+
+// Failures of the run, they are printed and appended to the corpus
+class Report
+{
+    public:
+        explicit Report(const char *corpus)
+            : m_corpus(corpus), m_failures(0), m_recording(true)
+        { }
+
+        template<typename T>
+        void Failure(const std::string &label, const char *path, const std::basic_string<T> &seq,
+                     const std::basic_string<T> &expected, const std::basic_string<T> &actual)
+        {
+            ++m_failures;
+            Formatter formatter;
+            const std::string description = formatter.Format("%? (%?): template '%?', expected '%?', actual '%?'",
+                    path, sizeof(T)==1 ? "char" : "wchar_t", Printable(seq), Printable(expected), Printable(actual));
+            if(m_failures <= 100)
+                std::fprintf(stderr, "formatter-fuzz: %s: %s\n", label.c_str(), description.c_str());
+            if(m_recording && m_corpus && label!=m_recorded)
+            {
+                std::ofstream corpus(m_corpus, std::ios::app);
+                corpus << label << ": " << description << '\n';
+                m_recorded = label;
+            }
+        }
+
+        uint64_t Failures() const
+        {
+            return m_failures;
+        }
+
+        // Replayed cases are already in the corpus
+        void Recording(bool recording)
+        {
+            m_recording = recording;
+        }
+
+    private:
+        const char *m_corpus;
+        uint64_t m_failures;
+        bool m_recording;
+        std::string m_recorded;
+};
+
+template<typename T>
+void Checker<T>::Compare(const Case<T> &c, const char *path, const String &expected, const String &actual)
+{
+    if(expected!=actual)
+        m_report.Failure(c.label, path, c.seq, expected, actual);
+}
+
+class Fuzzer
+{
+    public:
+        explicit Fuzzer(const char *corpus)
+            : m_report(corpus),
+              m_locales(CaseLocales()),
+              m_narrow(m_report, m_locales),
+              m_wide(m_report, m_locales),
+              m_mismatches(0)
+        { }
+
+        // Checks the case generated from the seed, a quarter of the cases use wide characters
+        void Run(uint64_t seed)
+        {
+            Random random(seed);
+            const std::string label = "seed " + std::to_string(seed);
+            if(Uniform(random, 4)==0)
+                m_wide.Run(label, random);
+            else
+                m_narrow.Run(label, random);
+            CheckVerifyLog(label);
+        }
+
+        ///\brief Replays the corpus: generated cases by their seeds and numbers recorded by FORMAT_UTIL_VERIFY.
+        ///\return Number of replayed cases
+        uint64_t Replay(const char *path)
+        {
+            std::ifstream corpus(path);
+            std::vector<std::string> lines;
+            for(std::string line; std::getline(corpus, line); )
+                lines.push_back(line);
+            m_report.Recording(false);
+            uint64_t replayed = 0;
+            for(size_t i = 0; i < lines.size(); ++i)
+            {
+                const std::string &line = lines[i];
+                if(line.compare(0, 5, "seed ")==0)
+                {
+                    Run(std::strtoull(line.c_str() + 5, nullptr, 10));
+                    ++replayed;
+                }
+                else if(ReplayNumber("corpus line " + std::to_string(i + 1), line))
+                    ++replayed;
+            }
+            m_report.Recording(true);
+            return replayed;
+        }
+
+        const Report& Result() const
+        {
+            return m_report;
+        }
+
+    private:
+        Report m_report;
+        const std::vector<std::locale> m_locales;
+        Checker<char> m_narrow;
+        Checker<wchar_t> m_wide;
+        size_t m_mismatches;
+
+        // Repeats the conversion of the number recorded by FORMAT_UTIL_VERIFY with its settings
+        bool ReplayNumber(const std::string &label, const std::string &line)
+        {
+            char kind[16];
+            char value[64];
+            char locale_name[64];
+            unsigned long flags;
+            long long precision;
+            if(std::sscanf(line.c_str(), "%15s value %63[^,], flags 0x%lx, precision %lld, locale '%63[^']'",
+                           kind, value, &flags, &precision, locale_name)!=5)
+                return false;
+            Settings settings;
+            settings.flags = static_cast<std::ios_base::fmtflags>(flags);
+            settings.precision = static_cast<std::streamsize>(precision);
+            try
+            {
+                settings.locale = std::strcmp(locale_name, "C")==0 ? std::locale::classic() : std::locale(locale_name);
+            }
+            catch(const std::runtime_error&)
+            {
+                return false; // The locale is not installed
+            }
+            if(std::strcmp(kind, "float")==0)
+            {
+                const double number = std::strtod(value, nullptr);
+                CheckNumber(label, settings, number);
+                if(std::isnan(number) || static_cast<double>(static_cast<float>(number))==number)
+                    CheckNumber(label, settings, static_cast<float>(number));
+            }
+            else if(value[0]=='-')
+            {
+                const long long number = std::strtoll(value, nullptr, 10);
+                CheckNumber(label, settings, number);
+                if(number >= std::numeric_limits<int>::min())
+                    CheckNumber(label, settings, static_cast<int>(number));
+            }
+            else
+            {
+                const unsigned long long number = std::strtoull(value, nullptr, 10);
+                CheckNumber(label, settings, number);
+                if(number <= std::numeric_limits<unsigned>::max())
+                    CheckNumber(label, settings, static_cast<unsigned>(number));
+            }
+            CheckVerifyLog(label);
+            return true;
+        }
+
+        template<typename V>
+        void CheckNumber(const std::string &label, const Settings &settings, V value)
+        {
+            m_narrow.CheckNumber(label, settings, value);
+            m_wide.CheckNumber(label, settings, value);
+        }
+
+        // Mismatches found by the formatter itself (FORMAT_UTIL_VERIFY) are failures of the case
+        void CheckVerifyLog(const std::string &label)
+        {
+#if FORMAT_UTIL_VERIFY
+            const std::vector<std::string> mismatches = Formatter::Mismatches();
+            for(; m_mismatches < mismatches.size(); ++m_mismatches)
+            {
+                m_report.Failure(label, "FORMAT_UTIL_VERIFY", std::string(), std::string(),
+                                 mismatches[m_mismatches]);
+            }
+#else
+            (void)label;
+#endif
+        }
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+    if(!options.seed_given)
+        options.seed = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    Fuzzer fuzzer(options.corpus);
+    uint64_t replayed = 0;
+    if(options.corpus)
+        replayed = fuzzer.Replay(options.corpus);
+    Random seeds(options.seed);
+    for(uint64_t i = 0; i < options.cases; ++i)
+        fuzzer.Run(seeds());
+    Formatter formatter;
+    std::fprintf(stderr, "%s", formatter.Format("formatter-fuzz: %? corpus cases, %? random cases (-s %?), %? failures\n",
+                                                replayed, options.cases, options.seed,
+                                                fuzzer.Result().Failures()).c_str());
+    return fuzzer.Result().Failures()==0 ? 0 : 1;
+}